@@ -0,0 +1,299 @@
+//
+// cache.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// for copy_file_range() and utimensat()
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+#include "cache.h"
+#include "tonecache.h"
+
+#define CACHE_SUFFIX ".wav"
+#define CACHE_NAME_SIZE (16 + sizeof(CACHE_SUFFIX))
+#define COPY_BUFFER_SIZE 65536
+#define STALE_TEMP_SECONDS 3600
+
+struct CacheEntry {
+    char name[CACHE_NAME_SIZE];
+    off_t size;
+    struct timespec used;
+};
+typedef struct CacheEntry CacheEntry;
+
+// path of cached file for key (FNV-1a hash, in hex), and of temporary file it is rendered into
+SoundError cache_path(const char *dir, const char *key, size_t key_size, char *path, char *temp_path)
+{
+    SoundError error = SE_NO_ERROR;
+    uint64_t hash = fnv1a_hash(key, key_size);
+
+    int length = snprintf(path, CACHE_PATH_SIZE, "%s/%016llx%s", dir, (unsigned long long)hash, CACHE_SUFFIX);
+    if (length < 0 || length >= CACHE_PATH_SIZE) error = SE_INVALID_NAME;
+
+    if (error == SE_NO_ERROR) {
+        length = snprintf(temp_path, CACHE_PATH_SIZE, "%s.%ld.tmp", path, (long)getpid());
+        if (length < 0 || length >= CACHE_PATH_SIZE) error = SE_INVALID_NAME;
+    }
+
+    return error;
+}
+
+// true if file is in cache; marks it recently used
+bool cache_lookup(const char *path)
+{
+    return utimensat(AT_FDCWD, path, NULL, 0) == 0;
+}
+
+// true if name is that of a cached file
+bool is_cache_name(const char *name);
+bool is_cache_name(const char *name)
+{
+    bool is_cached = strlen(name) == CACHE_NAME_SIZE - 1 && strcmp(name + 16, CACHE_SUFFIX) == 0;
+
+    for (int k = 0; k < 16 && is_cached; k++) {
+        if (strchr("0123456789abcdef", name[k]) == NULL) is_cached = false;
+    }
+
+    return is_cached;
+}
+
+// pid of process that renders into temporary file name (see cache_path()); 0 if name isn't one
+pid_t temp_name_pid(const char *name);
+pid_t temp_name_pid(const char *name)
+{
+    char cached_name[CACHE_NAME_SIZE];
+    const char *pid_text = name + CACHE_NAME_SIZE;
+    pid_t pid = 0;
+
+    if (strlen(name) > CACHE_NAME_SIZE && name[CACHE_NAME_SIZE - 1] == '.') {
+        char *end;
+        long value = strtol(pid_text, &end, 10);
+
+        memcpy(cached_name, name, CACHE_NAME_SIZE - 1);
+        cached_name[CACHE_NAME_SIZE - 1] = '\0';
+
+        if (is_cache_name(cached_name) && end != pid_text && strcmp(end, ".tmp") == 0 && value > 0) {
+            pid = (pid_t)value;
+        }
+    }
+
+    return pid;
+}
+
+// true if temporary file of process pid was left behind: the process has gone, or the file hasn't
+// been written to for STALE_TEMP_SECONDS (in case the pid has been reused)
+bool is_stale_temp(pid_t pid, const struct stat *status);
+bool is_stale_temp(pid_t pid, const struct stat *status)
+{
+    return (kill(pid, 0) != 0 && errno == ESRCH) || time(NULL) - status->st_mtime > STALE_TEMP_SECONDS;
+}
+
+int compare_used(const void *a, const void *b);
+int compare_used(const void *a, const void *b)
+{
+    const struct timespec *used_a = &((const CacheEntry *)a)->used;
+    const struct timespec *used_b = &((const CacheEntry *)b)->used;
+
+    if (used_a->tv_sec != used_b->tv_sec) return used_a->tv_sec < used_b->tv_sec ? -1 : 1;
+    if (used_a->tv_nsec != used_b->tv_nsec) return used_a->tv_nsec < used_b->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// remove temporary files left by renders that didn't finish, then least recently used files, other
+// than keep_name, until those left take no more than max_size bytes
+SoundError evict_cached(const char *dir, uint64_t max_size, const char *keep_name);
+SoundError evict_cached(const char *dir, uint64_t max_size, const char *keep_name)
+{
+    SoundError error = SE_NO_ERROR;
+    CacheEntry *entries = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint64_t total = 0;
+
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+    DIR *stream = dir_fd >= 0 ? fdopendir(dir_fd) : NULL;
+    if (stream == NULL) error = SE_FILE_READ_ERROR;
+
+    struct dirent *entry;
+    while (error == SE_NO_ERROR && (entry = readdir(stream)) != NULL) {
+        struct stat status;
+        pid_t pid = temp_name_pid(entry->d_name);
+
+        if (pid > 0 && fstatat(dir_fd, entry->d_name, &status, 0) == 0 && is_stale_temp(pid, &status)) {
+            unlinkat(dir_fd, entry->d_name, 0);
+
+        } else if (is_cache_name(entry->d_name) && fstatat(dir_fd, entry->d_name, &status, 0) == 0) {
+            if (count == capacity) {
+                capacity = capacity > 0 ? 2 * capacity : 64;
+                CacheEntry *resized = (CacheEntry *)realloc(entries, capacity * sizeof(CacheEntry));
+
+                if (resized == NULL) {
+                    error = SE_OUT_OF_MEMORY;
+
+                } else {
+                    entries = resized;
+                }
+            }
+
+            if (error == SE_NO_ERROR) {
+                // blocks rather than length, as silences are holes
+                strcpy(entries[count].name, entry->d_name);
+                entries[count].size = (off_t)status.st_blocks * 512;
+                entries[count].used = status.st_mtim;
+                total += (uint64_t)entries[count].size;
+                count++;
+            }
+        }
+    }
+
+    if (error == SE_NO_ERROR && total > max_size) {
+        qsort(entries, count, sizeof(CacheEntry), compare_used);
+
+        for (size_t k = 0; k < count && total > max_size; k++) {
+            if (strcmp(entries[k].name, keep_name) != 0 && unlinkat(dir_fd, entries[k].name, 0) == 0) {
+                total -= (uint64_t)entries[k].size;
+            }
+        }
+    }
+
+    free(entries);
+
+    if (stream != NULL) {
+        closedir(stream);
+
+    } else if (dir_fd >= 0) {
+        close(dir_fd);
+    }
+
+    return error;
+}
+
+// add file rendered into temp_path to cache, then keep cache within max_size bytes; the file just
+// added is kept even if it is larger than that, as it is about to be used
+SoundError cache_store(const char *dir, const char *temp_path, const char *path, uint64_t max_size)
+{
+    SoundError error = SE_NO_ERROR;
+    const char *name = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+
+    // renaming is atomic, so other processes see the whole file or none
+    if (rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        error = SE_FILE_WRITE_ERROR;
+    }
+
+    if (error == SE_NO_ERROR) error = evict_cached(dir, max_size, name);
+
+    return error;
+}
+
+// copy cached file to out_path (- for standard output): within the kernel where possible, by
+// copy_file_range() between files and sendfile() to pipes and sockets
+SoundError copy_cached(const char *path, const char *out_path)
+{
+    SoundError error = SE_NO_ERROR;
+    bool to_stdout = strcmp(out_path, "-") == 0;
+    struct stat status;
+    off_t remaining = 0;
+
+    int in = open(path, O_RDONLY);
+    if (in < 0 || fstat(in, &status) != 0) error = SE_INPUT_FILE_OPEN_ERROR;
+
+    int out = -1;
+    if (error == SE_NO_ERROR) {
+        if (to_stdout) fflush(stdout);
+        out = to_stdout ? STDOUT_FILENO : open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (out < 0) error = SE_OUTPUT_FILE_OPEN_ERROR;
+    }
+
+    if (error == SE_NO_ERROR) remaining = status.st_size;
+
+#ifdef __linux__
+    // each of these leaves off where the other (or a failed call) stopped
+    while (error == SE_NO_ERROR && remaining > 0) {
+        ssize_t copied = copy_file_range(in, NULL, out, NULL, (size_t)remaining, 0);
+        if (copied <= 0) break;
+        remaining -= copied;
+    }
+
+    while (error == SE_NO_ERROR && remaining > 0) {
+        ssize_t copied = sendfile(out, in, NULL, (size_t)remaining);
+        if (copied <= 0) break;
+        remaining -= copied;
+    }
+#endif
+
+    if (error == SE_NO_ERROR && remaining > 0) {
+        char *buffer = (char *)malloc(COPY_BUFFER_SIZE);
+        if (buffer == NULL) error = SE_OUT_OF_MEMORY;
+
+        while (error == SE_NO_ERROR && remaining > 0) {
+            ssize_t count = read(in, buffer, COPY_BUFFER_SIZE);
+
+            if (count <= 0) {
+                error = SE_FILE_READ_ERROR;
+
+            } else {
+                for (ssize_t done = 0; done < count && error == SE_NO_ERROR; ) {
+                    ssize_t written = write(out, buffer + done, (size_t)(count - done));
+
+                    if (written > 0) {
+                        done += written;
+
+                    } else if (written < 0 && errno != EINTR) {
+                        error = SE_FILE_WRITE_ERROR;
+                    }
+                }
+
+                remaining -= count;
+            }
+        }
+
+        free(buffer);
+    }
+
+    if (in >= 0) close(in);
+    if (out >= 0 && !to_stdout && close(out) != 0 && error == SE_NO_ERROR) error = SE_FILE_WRITE_ERROR;
+
+    return error;
+}
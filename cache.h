@@ -0,0 +1,49 @@
+//
+// cache.h
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef cache_h
+#define cache_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sound.h"
+
+// On-disk render cache: rendered .wav files are stored in a directory, named by a hash of a key
+// that describes everything that determines their contents (see cache_key() in mbeep.c). A hit
+// is copied to the output file by the kernel, or played from a memory mapping, so repeated
+// renders cost file I/O rather than synthesis. Using a file marks it recently used; after a file is
+// stored, the least recently used files other than it are removed until the directory is under its
+// size limit.
+
+#define CACHE_PATH_SIZE 4096
+
+SoundError cache_path(const char *dir, const char *key, size_t key_size, char *path, char *temp_path);
+bool cache_lookup(const char *path);
+SoundError cache_store(const char *dir, const char *temp_path, const char *path, uint64_t max_size);
+SoundError copy_cached(const char *path, const char *out_path);
+
+#endif /* cache_h */
@@ -0,0 +1,601 @@
+//
+// convert.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "convert.h"
+
+#define DITHER_BLOCK 256
+
+// state of pseudo-random generator for dither (xorshift32)
+uint32_t dither_state = 2463534242U;
+
+// triangular (TPDF) dither noise, in units of one least significant bit: the sum of two
+// independent uniform random values, in the range (-1.0, 1.0)
+void make_dither(float *noise, size_t count);
+void make_dither(float *noise, size_t count)
+{
+    uint32_t x = dither_state;
+
+    for (size_t k = 0; k < count; k++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        uint32_t a = x & 0xFFFF;
+        uint32_t b = x >> 16;
+        noise[k] = ((float)a - (float)b) * (1.0f / 65536.0f);
+    }
+
+    dither_state = x;
+}
+
+// Convert to 16-bit samples, rounding to nearest, with optional TPDF dither. Samples are offset by
+// 32768.5 and clamped to [0, 65535.5) so that truncating conversion rounds to nearest in the same
+// way for the vector and scalar code.
+void float_to_int16(const float *in, int16_t *out, size_t count, bool dither)
+{
+    float noise[DITHER_BLOCK];
+
+    while (count > 0) {
+        size_t block = count < DITHER_BLOCK ? count : DITHER_BLOCK;
+        size_t k = 0;
+
+        if (dither) {
+            make_dither(noise, block);
+
+        } else {
+            memset(noise, 0, block * sizeof(float));
+        }
+
+#if defined(__SSE2__)
+        const __m128 scale = _mm_set1_ps(32768.0f);
+        const __m128 offset = _mm_set1_ps(32768.5f);
+        const __m128 low = _mm_setzero_ps();
+        const __m128 high = _mm_set1_ps(65535.0f);
+        const __m128i bias = _mm_set1_epi32(32768);
+
+        for (; k + 8 <= block; k += 8) {
+            __m128 a = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + k), scale), _mm_loadu_ps(noise + k));
+            __m128 b = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in + k + 4), scale), _mm_loadu_ps(noise + k + 4));
+            a = _mm_min_ps(_mm_max_ps(_mm_add_ps(a, offset), low), high);
+            b = _mm_min_ps(_mm_max_ps(_mm_add_ps(b, offset), low), high);
+            __m128i ia = _mm_sub_epi32(_mm_cvttps_epi32(a), bias);
+            __m128i ib = _mm_sub_epi32(_mm_cvttps_epi32(b), bias);
+            _mm_storeu_si128((__m128i *)(out + k), _mm_packs_epi32(ia, ib));
+        }
+
+#elif defined(__ARM_NEON)
+        const float32x4_t scale = vdupq_n_f32(32768.0f);
+        const float32x4_t offset = vdupq_n_f32(32768.5f);
+        const float32x4_t low = vdupq_n_f32(0.0f);
+        const float32x4_t high = vdupq_n_f32(65535.0f);
+        const int32x4_t bias = vdupq_n_s32(32768);
+
+        for (; k + 4 <= block; k += 4) {
+            float32x4_t a = vmlaq_f32(vld1q_f32(noise + k), vld1q_f32(in + k), scale);
+            a = vminq_f32(vmaxq_f32(vaddq_f32(a, offset), low), high);
+            int32x4_t ia = vsubq_s32(vreinterpretq_s32_u32(vcvtq_u32_f32(a)), bias);
+            vst1_s16(out + k, vmovn_s32(ia));
+        }
+#endif
+
+        for (; k < block; k++) {
+            float value = in[k] * 32768.0f + noise[k] + 32768.5f;
+            if (value < 0.0f) value = 0.0f;
+            if (value > 65535.0f) value = 65535.0f;
+            out[k] = (int16_t)((int32_t)value - 32768);
+        }
+
+        in += block;
+        out += block;
+        count -= block;
+    }
+}
+
+// convert to packed little-endian 24-bit samples, rounding to nearest
+void float_to_int24(const float *in, uint8_t *out, size_t count)
+{
+    for (size_t k = 0; k < count; k++) {
+        double value = floor((double)in[k] * 8388608.0 + 0.5);
+        if (value > 8388607.0) value = 8388607.0;
+        if (value < -8388608.0) value = -8388608.0;
+
+        int32_t sample = (int32_t)value;
+        *out++ = (uint8_t)(sample & 0xFF);
+        *out++ = (uint8_t)((sample >> 8) & 0xFF);
+        *out++ = (uint8_t)((sample >> 16) & 0xFF);
+    }
+}
+
+// G.711 companding (ITU-T G.711), as in the reference code: mu-law from 14-bit and A-law from 13-bit
+// values. The segment (exponent) of a value is its highest set bit, found from segment_table for
+// scalar code; vector code gets the segment and the 4 bits below the highest bit from the exponent
+// and mantissa of the value converted to float, which is exact for these integers.
+#define ULAW_BIAS 0x84
+#define ULAW_CLIP 8158 // the reference clips at 8159, whose biased value saturates to the same code
+
+uint8_t segment_table[256];
+int16_t ulaw_table[256];
+int16_t alaw_table[256];
+bool g711_tables_OK = false;
+
+void init_g711_tables(void);
+void init_g711_tables(void)
+{
+    if (!g711_tables_OK) {
+        for (int k = 0; k < 256; k++) {
+            uint8_t segment = 0;
+            while (segment < 7 && (k >> (segment + 1)) != 0) segment++;
+            segment_table[k] = segment;
+
+            int u = ~k & 0xFF;
+            int magnitude = ((((u & 0x0F) << 3) + ULAW_BIAS) << ((u >> 4) & 0x07)) - ULAW_BIAS;
+            ulaw_table[k] = (int16_t)((u & 0x80) ? -magnitude : magnitude);
+
+            int a = k ^ 0x55;
+            int a_segment = (a & 0x70) >> 4;
+            int value = ((a & 0x0F) << 4) + (a_segment == 0 ? 8 : 0x108);
+            if (a_segment > 1) value <<= a_segment - 1;
+            alaw_table[k] = (int16_t)((a & 0x80) ? value : -value);
+        }
+
+        g711_tables_OK = true;
+    }
+}
+
+uint8_t linear_to_ulaw(int16_t sample);
+uint8_t linear_to_ulaw(int16_t sample)
+{
+    int value = sample >> 2;
+    int mask = 0xFF;
+
+    if (value < 0) {
+        mask = 0x7F;
+        value = -value;
+    }
+
+    if (value > ULAW_CLIP) value = ULAW_CLIP;
+    value += ULAW_BIAS >> 2;
+
+    int segment = segment_table[value >> 5];
+    int mantissa = (value >> (segment + 1)) & 0x0F;
+
+    return (uint8_t)(((segment << 4) | mantissa) ^ mask);
+}
+
+uint8_t linear_to_alaw(int16_t sample);
+uint8_t linear_to_alaw(int16_t sample)
+{
+    int value = sample >> 3;
+    int mask = 0xD5;
+
+    if (value < 0) {
+        mask = 0x55;
+        value = -value - 1;
+    }
+
+    int segment = value < 0x20 ? 0 : segment_table[value >> 4];
+    int mantissa = (value >> (segment < 2 ? 1 : segment)) & 0x0F;
+
+    return (uint8_t)(((segment << 4) | mantissa) ^ mask);
+}
+
+#if defined(__SSE2__)
+// sign-extend 8 samples to two vectors of 32-bit values
+#define LOAD_INT16X8(in, low, high) do { \
+    __m128i x = _mm_loadu_si128((const __m128i *)(in)); \
+    low = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16); \
+    high = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16); \
+} while (0)
+
+// highest set bit and the 4 bits below it, for 0 < value < 2^24
+static inline void segment_mantissa(__m128i value, __m128i *high_bit, __m128i *mantissa)
+{
+    __m128i bits = _mm_castps_si128(_mm_cvtepi32_ps(value));
+    *high_bit = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+    *mantissa = _mm_and_si128(_mm_srli_epi32(bits, 19), _mm_set1_epi32(0x0F));
+}
+
+static inline __m128i ulaw_x4(__m128i x)
+{
+    __m128i value = _mm_srai_epi32(x, 2);
+    __m128i negative = _mm_srai_epi32(value, 31);
+    __m128i mask = _mm_or_si128(_mm_set1_epi32(0x7F), _mm_andnot_si128(negative, _mm_set1_epi32(0x80)));
+    value = _mm_sub_epi32(_mm_xor_si128(value, negative), negative);
+
+    __m128i clip = _mm_set1_epi32(ULAW_CLIP);
+    __m128i over = _mm_cmpgt_epi32(value, clip);
+    value = _mm_or_si128(_mm_andnot_si128(over, value), _mm_and_si128(over, clip));
+    value = _mm_add_epi32(value, _mm_set1_epi32(ULAW_BIAS >> 2));
+
+    __m128i high_bit, mantissa;
+    segment_mantissa(value, &high_bit, &mantissa);
+    __m128i segment = _mm_sub_epi32(high_bit, _mm_set1_epi32(5));
+
+    return _mm_xor_si128(_mm_or_si128(_mm_slli_epi32(segment, 4), mantissa), mask);
+}
+
+static inline __m128i alaw_x4(__m128i x)
+{
+    __m128i value = _mm_srai_epi32(x, 3);
+    __m128i negative = _mm_srai_epi32(value, 31);
+    __m128i mask = _mm_or_si128(_mm_set1_epi32(0x55), _mm_andnot_si128(negative, _mm_set1_epi32(0x80)));
+    value = _mm_xor_si128(value, negative);
+
+    __m128i high_bit, mantissa;
+    segment_mantissa(value, &high_bit, &mantissa);
+    __m128i segment = _mm_sub_epi32(high_bit, _mm_set1_epi32(4));
+
+    // segment 0 (value < 0x20) is linear
+    __m128i small = _mm_cmplt_epi32(value, _mm_set1_epi32(0x20));
+    __m128i small_mantissa = _mm_and_si128(_mm_srli_epi32(value, 1), _mm_set1_epi32(0x0F));
+    segment = _mm_andnot_si128(small, segment);
+    mantissa = _mm_or_si128(_mm_andnot_si128(small, mantissa), _mm_and_si128(small, small_mantissa));
+
+    return _mm_xor_si128(_mm_or_si128(_mm_slli_epi32(segment, 4), mantissa), mask);
+}
+
+static inline void store_uint8x8(uint8_t *out, __m128i low, __m128i high)
+{
+    __m128i packed = _mm_packs_epi32(low, high);
+    _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(packed, packed));
+}
+#endif
+
+void int16_to_ulaw(const int16_t *in, uint8_t *out, size_t count)
+{
+    size_t k = 0;
+
+    init_g711_tables();
+
+#if defined(__SSE2__)
+    for (; k + 8 <= count; k += 8) {
+        __m128i low, high;
+        LOAD_INT16X8(in + k, low, high);
+        store_uint8x8(out + k, ulaw_x4(low), ulaw_x4(high));
+    }
+#endif
+
+    for (; k < count; k++) out[k] = linear_to_ulaw(in[k]);
+}
+
+void int16_to_alaw(const int16_t *in, uint8_t *out, size_t count)
+{
+    size_t k = 0;
+
+    init_g711_tables();
+
+#if defined(__SSE2__)
+    for (; k + 8 <= count; k += 8) {
+        __m128i low, high;
+        LOAD_INT16X8(in + k, low, high);
+        store_uint8x8(out + k, alaw_x4(low), alaw_x4(high));
+    }
+#endif
+
+    for (; k < count; k++) out[k] = linear_to_alaw(in[k]);
+}
+
+void ulaw_to_int16(const uint8_t *in, int16_t *out, size_t count)
+{
+    init_g711_tables();
+
+    for (size_t k = 0; k < count; k++) out[k] = ulaw_table[in[k]];
+}
+
+void alaw_to_int16(const uint8_t *in, int16_t *out, size_t count)
+{
+    init_g711_tables();
+
+    for (size_t k = 0; k < count; k++) out[k] = alaw_table[in[k]];
+}
+
+// IMA ADPCM (mono, as in .wav files): each block starts with the first sample and the step index,
+// followed by 4-bit codes for the remaining samples, two per byte, low nibble first. The step index
+// carries over from block to block.
+const int16_t ima_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+    73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408,
+    449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630,
+    9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const int8_t ima_index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// number of samples in block of given size
+size_t ima_adpcm_block_samples(size_t block_align)
+{
+    return 2 * (block_align - 4) + 1;
+}
+
+// apply code to predictor and step index; returns new predictor
+static inline int ima_adpcm_step(int predictor, int *index, int code)
+{
+    int step = ima_step_table[*index];
+    int difference = step >> 3;
+
+    if (code & 4) difference += step;
+    if (code & 2) difference += step >> 1;
+    if (code & 1) difference += step >> 2;
+
+    predictor += (code & 8) ? -difference : difference;
+    if (predictor > 32767) predictor = 32767;
+    if (predictor < -32768) predictor = -32768;
+
+    *index += ima_index_table[code];
+    if (*index < 0) *index = 0;
+    if (*index > 88) *index = 88;
+
+    return predictor;
+}
+
+void int16_to_ima_adpcm(const int16_t *in, uint8_t *out, size_t block_align, int *index)
+{
+    size_t count = ima_adpcm_block_samples(block_align);
+    int predictor = in[0];
+
+    out[0] = (uint8_t)(in[0] & 0xFF);
+    out[1] = (uint8_t)((in[0] >> 8) & 0xFF);
+    out[2] = (uint8_t)*index;
+    out[3] = 0;
+    memset(out + 4, 0, block_align - 4);
+
+    for (size_t k = 1; k < count; k++) {
+        int step = ima_step_table[*index];
+        int difference = in[k] - predictor;
+        int code = 0;
+
+        if (difference < 0) {
+            code = 8;
+            difference = -difference;
+        }
+
+        if (difference >= step) {
+            code |= 4;
+            difference -= step;
+        }
+
+        if (difference >= step >> 1) {
+            code |= 2;
+            difference -= step >> 1;
+        }
+
+        if (difference >= step >> 2) code |= 1;
+
+        predictor = ima_adpcm_step(predictor, index, code);
+        out[4 + (k - 1) / 2] |= (uint8_t)((k & 1) ? code : code << 4);
+    }
+}
+
+void ima_adpcm_to_int16(const uint8_t *in, int16_t *out, size_t block_align)
+{
+    size_t count = ima_adpcm_block_samples(block_align);
+    int predictor = (int16_t)(in[0] | (in[1] << 8));
+    int index = in[2] > 88 ? 88 : in[2];
+
+    out[0] = (int16_t)predictor;
+
+    for (size_t k = 1; k < count; k++) {
+        int code = (in[4 + (k - 1) / 2] >> ((k & 1) ? 0 : 4)) & 0x0F;
+        predictor = ima_adpcm_step(predictor, &index, code);
+        out[k] = (int16_t)predictor;
+    }
+}
+
+// Conversion of .wav file frames for playing: samples are scaled to float a block at a time,
+// channels are averaged, and the result is rounded to 16 bits.
+#define FRAME_BLOCK (16 * MAX_FRAME_CHANNELS)
+
+// convert count integer (8-bit unsigned, 16, 24 or 32-bit) or float (32 or 64-bit) samples to float
+void pcm_to_float(const uint8_t *in, float *out, size_t count, unsigned int bits, bool is_float);
+void pcm_to_float(const uint8_t *in, float *out, size_t count, unsigned int bits, bool is_float)
+{
+    size_t k = 0;
+
+    if (is_float && bits == 32) {
+        memcpy(out, in, count * sizeof(float));
+
+    } else if (is_float) {
+        for (; k < count; k++) {
+            double value;
+            memcpy(&value, in + 8 * k, sizeof(value));
+            out[k] = (float)value;
+        }
+
+    } else if (bits == 8) {
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i offset = _mm_set1_epi16(128);
+        const __m128 scale = _mm_set1_ps(1.0f / 128.0f);
+
+        for (; k + 8 <= count; k += 8) {
+            __m128i x = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(in + k)), zero), offset);
+            __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+            __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+            _mm_storeu_ps(out + k, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+            _mm_storeu_ps(out + k + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+        }
+
+#elif defined(__ARM_NEON)
+        const uint16x8_t offset = vdupq_n_u16(128);
+        const float32x4_t scale = vdupq_n_f32(1.0f / 128.0f);
+
+        for (; k + 8 <= count; k += 8) {
+            int16x8_t x = vreinterpretq_s16_u16(vsubq_u16(vmovl_u8(vld1_u8(in + k)), offset));
+            vst1q_f32(out + k, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+            vst1q_f32(out + k + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+        }
+#endif
+
+        for (; k < count; k++) out[k] = ((int)in[k] - 128) * (1.0f / 128.0f);
+
+    } else if (bits == 16) {
+#if defined(__SSE2__)
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+
+        for (; k + 8 <= count; k += 8) {
+            __m128i low, high;
+            LOAD_INT16X8(in + 2 * k, low, high);
+            _mm_storeu_ps(out + k, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+            _mm_storeu_ps(out + k + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+        }
+
+#elif defined(__ARM_NEON)
+        const float32x4_t scale = vdupq_n_f32(1.0f / 32768.0f);
+
+        for (; k + 8 <= count; k += 8) {
+            int16x8_t x = vreinterpretq_s16_u8(vld1q_u8(in + 2 * k));
+            vst1q_f32(out + k, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+            vst1q_f32(out + k + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+        }
+#endif
+
+        for (; k < count; k++) {
+            int16_t value;
+            memcpy(&value, in + 2 * k, sizeof(value));
+            out[k] = value * (1.0f / 32768.0f);
+        }
+
+    } else if (bits == 24) {
+        for (; k < count; k++, in += 3) {
+            int32_t value = (int32_t)((uint32_t)in[0] << 8 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 24);
+            out[k] = value * (1.0f / 2147483648.0f);
+        }
+
+    } else {
+#if defined(__SSE2__)
+        const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+
+        for (; k + 4 <= count; k += 4) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(in + 4 * k));
+            _mm_storeu_ps(out + k, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+        }
+
+#elif defined(__ARM_NEON)
+        const float32x4_t scale = vdupq_n_f32(1.0f / 2147483648.0f);
+
+        for (; k + 4 <= count; k += 4) {
+            int32x4_t x = vreinterpretq_s32_u8(vld1q_u8(in + 4 * k));
+            vst1q_f32(out + k, vmulq_f32(vcvtq_f32_s32(x), scale));
+        }
+#endif
+
+        for (; k < count; k++) {
+            int32_t value;
+            memcpy(&value, in + 4 * k, sizeof(value));
+            out[k] = value * (1.0f / 2147483648.0f);
+        }
+    }
+}
+
+// average channels of interleaved frames
+void downmix_float(const float *in, float *out, size_t frames, unsigned int channels);
+void downmix_float(const float *in, float *out, size_t frames, unsigned int channels)
+{
+    size_t k = 0;
+
+    if (channels == 2) {
+#if defined(__SSE2__)
+        const __m128 half = _mm_set1_ps(0.5f);
+
+        for (; k + 4 <= frames; k += 4) {
+            __m128 a = _mm_loadu_ps(in + 2 * k);
+            __m128 b = _mm_loadu_ps(in + 2 * k + 4);
+            __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_storeu_ps(out + k, _mm_mul_ps(_mm_add_ps(left, right), half));
+        }
+
+#elif defined(__ARM_NEON)
+        const float32x4_t half = vdupq_n_f32(0.5f);
+
+        for (; k + 4 <= frames; k += 4) {
+            float32x4x2_t x = vld2q_f32(in + 2 * k);
+            vst1q_f32(out + k, vmulq_f32(vaddq_f32(x.val[0], x.val[1]), half));
+        }
+#endif
+    }
+
+    float scale = 1.0f / channels;
+
+    for (; k < frames; k++) {
+        float sum = 0.0f;
+        for (unsigned int channel = 0; channel < channels; channel++) sum += in[k * channels + channel];
+        out[k] = sum * scale;
+    }
+}
+
+void frames_to_float(const uint8_t *in, float *out, size_t frames, unsigned int channels,
+                     unsigned int bits, bool is_float)
+{
+    float samples[FRAME_BLOCK];
+    size_t block_frames = FRAME_BLOCK / channels;
+
+    if (channels == 1) {
+        pcm_to_float(in, out, frames, bits, is_float);
+
+    } else {
+        while (frames > 0) {
+            size_t block = frames < block_frames ? frames : block_frames;
+
+            pcm_to_float(in, samples, block * channels, bits, is_float);
+            downmix_float(samples, out, block, channels);
+
+            in += block * channels * (bits / 8);
+            out += block;
+            frames -= block;
+        }
+    }
+}
+
+void frames_to_int16(const uint8_t *in, int16_t *out, size_t frames, unsigned int channels,
+                     unsigned int bits, bool is_float)
+{
+    float mono[FRAME_BLOCK];
+
+    while (frames > 0) {
+        size_t block = frames < FRAME_BLOCK ? frames : FRAME_BLOCK;
+
+        frames_to_float(in, mono, block, channels, bits, is_float);
+        float_to_int16(mono, out, block, false);
+
+        in += block * channels * (bits / 8);
+        out += block;
+        frames -= block;
+    }
+}
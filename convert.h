@@ -0,0 +1,59 @@
+//
+// convert.h
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef convert_h
+#define convert_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sample format conversion. Floating-point samples are in the range [-1.0, 1.0).
+
+void float_to_int16(const float *in, int16_t *out, size_t count, bool dither);
+void float_to_int24(const float *in, uint8_t *out, size_t count);
+
+// G.711 mu-law and A-law
+void int16_to_ulaw(const int16_t *in, uint8_t *out, size_t count);
+void int16_to_alaw(const int16_t *in, uint8_t *out, size_t count);
+void ulaw_to_int16(const uint8_t *in, int16_t *out, size_t count);
+void alaw_to_int16(const uint8_t *in, int16_t *out, size_t count);
+
+// IMA ADPCM, one mono block at a time; index is step index, carried from block to block
+size_t ima_adpcm_block_samples(size_t block_align);
+void int16_to_ima_adpcm(const int16_t *in, uint8_t *out, size_t block_align, int *index);
+void ima_adpcm_to_int16(const uint8_t *in, int16_t *out, size_t block_align);
+
+// Interleaved .wav frames of integer (8-bit unsigned, 16, 24 or 32-bit) or float (32 or 64-bit)
+// samples, converted to mono by averaging channels
+#define MAX_FRAME_CHANNELS 256
+
+void frames_to_float(const uint8_t *in, float *out, size_t frames, unsigned int channels,
+                     unsigned int bits, bool is_float);
+void frames_to_int16(const uint8_t *in, int16_t *out, size_t frames, unsigned int channels,
+                     unsigned int bits, bool is_float);
+
+#endif /* convert_h */
@@ -0,0 +1,947 @@
+//
+// daemon.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// for SCM_RIGHTS, fchdir() and lstat()
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef __APPLE__
+#include <stdio_ext.h>
+#endif
+
+#include "daemon.h"
+
+// The client sends the program name and options, each terminated by a NUL byte, then shuts down
+// its side of the connection. The first message carries the client's working directory and
+// standard input, output and error (SCM_RIGHTS). When the request is done, the daemon replies with
+// its SoundError as a decimal number and newline, and closes the connection.
+#define MAX_REQUEST_SIZE 65536
+#define DEFAULT_OPTIONS "-p"
+#define PASSED_FDS 4
+#define REPLY_SIZE 16
+
+// Connections are non-blocking: requests are received a piece at a time, as poll() reports them,
+// so that a slow client never holds up the daemon (requests are also collected while playing, see
+// preempt_requested()). A request that hasn't all arrived within REQUEST_TIMEOUT_MSEC is dropped.
+#define REQUEST_TIMEOUT_MSEC 2000
+#define MAX_RECEIVING_REQUESTS 16
+
+volatile sig_atomic_t daemon_stopping = 0;
+
+void stop_daemon(int signal_number);
+void stop_daemon(int signal_number)
+{
+    (void)signal_number;
+    daemon_stopping = 1;
+}
+
+// stop on SIGINT or SIGTERM (see stop_requested()), and survive clients that go away
+void catch_stop_signals(void)
+{
+    struct sigaction action;
+
+    // no SA_RESTART, so that poll() returns when daemon is stopped
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_daemon;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    signal(SIGPIPE, SIG_IGN);
+}
+
+bool stop_requested(void)
+{
+    return daemon_stopping;
+}
+
+// fill in address of socket at path
+SoundError socket_address(const char *path, struct sockaddr_un *address);
+SoundError socket_address(const char *path, struct sockaddr_un *address)
+{
+    SoundError error = SE_NO_ERROR;
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        error = SE_INVALID_VALUE;
+
+    } else {
+        strcpy(address->sun_path, path);
+    }
+
+    return error;
+}
+
+// connect to socket at address; returns socket, or -1
+int connect_socket(const struct sockaddr_un *address);
+int connect_socket(const struct sockaddr_un *address)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd >= 0 && connect(fd, (const struct sockaddr *)address, sizeof(*address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+// make fd non-blocking
+bool set_non_blocking(int fd);
+bool set_non_blocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// read what has arrived of request (up to MAX_REQUEST_SIZE bytes, size so far) and descriptors
+// passed with it, without waiting; descriptors not passed are left as they are. complete is set
+// when the client has shut down its side.
+SoundError receive_request(int connection, char *request, size_t *size, int fds[PASSED_FDS], bool *complete);
+SoundError receive_request(int connection, char *request, size_t *size, int fds[PASSED_FDS], bool *complete)
+{
+    SoundError error = SE_NO_ERROR;
+    ssize_t received = 1;
+
+    while (error == SE_NO_ERROR && received > 0) {
+        union {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(PASSED_FDS * sizeof(int))];
+        } control;
+        struct iovec iov = { request + *size, MAX_REQUEST_SIZE - *size };
+        struct msghdr message;
+
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.space;
+        message.msg_controllen = sizeof(control.space);
+
+        if (*size == MAX_REQUEST_SIZE) {
+            error = SE_INVALID_VALUE;
+
+        } else {
+            received = recvmsg(connection, &message, 0);
+        }
+
+        if (error != SE_NO_ERROR) {
+            // request too long
+
+        } else if (received < 0) {
+            // nothing more for now
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) error = SE_SOCKET_ERROR;
+
+        } else if (received == 0) {
+            *complete = true;
+
+        } else {
+            // descriptors come with the first message
+            for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != NULL;
+                 header = CMSG_NXTHDR(&message, header)) {
+                if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+                    memcpy(fds, CMSG_DATA(header), header->cmsg_len - CMSG_LEN(0));
+                }
+            }
+
+            *size += (size_t)received;
+        }
+    }
+
+    return error;
+}
+
+// discard what stdio has read ahead from standard input, which came from the previous client
+void discard_buffered_input(void);
+void discard_buffered_input(void)
+{
+#ifdef __APPLE__
+    fpurge(stdin);
+#else
+    __fpurge(stdin);
+#endif
+    clearerr(stdin);
+}
+
+// run request with client's working directory and standard files in place of the daemon's own
+SoundError run_as_client(RequestHandler handler, int argc, const char *argv[], const int fds[PASSED_FDS]);
+SoundError run_as_client(RequestHandler handler, int argc, const char *argv[], const int fds[PASSED_FDS])
+{
+    SoundError error = SE_NO_ERROR;
+    int saved[PASSED_FDS];
+
+    fflush(stdout);
+    fflush(stderr);
+
+    saved[0] = open(".", O_RDONLY);
+    if (fds[0] >= 0 && fchdir(fds[0]) != 0) error = SE_INPUT_FILE_OPEN_ERROR;
+
+    for (int k = 1; k < PASSED_FDS; k++) {
+        saved[k] = dup(k - 1);
+        if (fds[k] >= 0) dup2(fds[k], k - 1);
+    }
+
+    discard_buffered_input();
+
+    if (error == SE_NO_ERROR) error = handler(argc, argv);
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int k = 1; k < PASSED_FDS; k++) {
+        if (saved[k] >= 0) {
+            dup2(saved[k], k - 1);
+            close(saved[k]);
+
+        } else {
+            close(k - 1);
+        }
+    }
+
+    discard_buffered_input();
+
+    if (saved[0] >= 0) {
+        if (fchdir(saved[0]) != 0 && error == SE_NO_ERROR) error = SE_INPUT_FILE_OPEN_ERROR;
+        close(saved[0]);
+    }
+
+    return error;
+}
+
+// Requests wait until the device is free, and the one with the highest priority is run first;
+// requests of the same priority are run in the order they arrived. A request with a higher
+// priority than the one playing preempts it (see set_preempt_check()). With BP_DROP, a request
+// that can't be run right away is dropped instead of waiting. Dropped and preempted requests are
+// answered with SE_BUSY and SE_PREEMPTED.
+#define MAX_PENDING_REQUESTS 64
+#define PRIORITY_OPTION "--priority"
+
+struct Request {
+    int connection;             // client, or -1 for a request read from standard input
+    int fds[PASSED_FDS];        // passed by client, or -1
+    int priority;
+    unsigned long sequence;     // order of arrival
+    char *text;                 // program name and options, each NUL-terminated
+    size_t size;                // bytes of text received
+    struct timeval deadline;    // for all of it to arrive
+    int argc;
+    const char **argv;
+};
+typedef struct Request Request;
+
+BusyPolicy busy_policy = BP_QUEUE;
+int listener = -1;
+bool reading_input = false;
+char input_text[MAX_REQUEST_SIZE + 1];
+LineBuffer input_lines = { input_text, MAX_REQUEST_SIZE, 0 };
+
+Request *pending[MAX_PENDING_REQUESTS];
+int pending_count = 0;
+Request *receiving[MAX_RECEIVING_REQUESTS];
+int receiving_count = 0;
+unsigned long request_sequence = 0;
+Request *running = NULL;
+
+Request *new_request(int connection);
+Request *new_request(int connection)
+{
+    Request *request = (Request *)calloc(1, sizeof(Request));
+
+    if (request != NULL) {
+        request->connection = connection;
+        for (int k = 0; k < PASSED_FDS; k++) request->fds[k] = -1;
+        request->sequence = request_sequence++;
+    }
+
+    return request;
+}
+
+// reply to client with result of request (a request from standard input only reports errors), and
+// free it
+void finish_request(Request *request, SoundError result);
+void finish_request(Request *request, SoundError result)
+{
+    if (request->connection >= 0) {
+        // if client has gone away, there's no one to tell
+        char reply[REPLY_SIZE];
+        int length = snprintf(reply, sizeof(reply), "%d\n", (int)result);
+        send(request->connection, reply, (size_t)length, 0);
+        close(request->connection);
+
+    } else if (result != SE_NO_ERROR) {
+        fprintf(stderr, "Error: %s\n", sound_error_text(result));
+    }
+
+    for (int k = 0; k < PASSED_FDS; k++) {
+        if (request->fds[k] >= 0) close(request->fds[k]);
+    }
+
+    free(request->argv);
+    free(request->text);
+    free(request);
+}
+
+// split text of request (size bytes) into arguments, and take priority from them
+SoundError parse_request(Request *request, size_t size);
+SoundError parse_request(Request *request, size_t size)
+{
+    SoundError error = SE_NO_ERROR;
+    char *text = request->text;
+
+    // program name and options are NUL-terminated strings
+    if (size == 0 || text[size - 1] != '\0') error = SE_INVALID_OPTION;
+
+    if (error == SE_NO_ERROR) {
+        for (size_t k = 0; k < size; k++) {
+            if (text[k] == '\0') request->argc++;
+        }
+
+        request->argv = (const char **)malloc((request->argc + 1) * sizeof(const char *));
+        if (request->argv == NULL) error = SE_OUT_OF_MEMORY;
+    }
+
+    if (error == SE_NO_ERROR) {
+        int n = 0;
+        for (size_t k = 0; k < size; k += strlen(text + k) + 1) request->argv[n++] = text + k;
+        request->argv[request->argc] = NULL;
+
+        // --priority, if given, is the first option
+        if (request->argc >= 2 && strcmp(request->argv[1], PRIORITY_OPTION) == 0) {
+            char *end = NULL;
+            long value = request->argc >= 3 ? strtol(request->argv[2], &end, 10) : 0;
+
+            if (end == NULL || end == request->argv[2] || *end != '\0' || value < INT_MIN || value > INT_MAX) {
+                error = SE_INVALID_VALUE;
+
+            } else {
+                request->priority = (int)value;
+                request->argc -= 2;
+                memmove(request->argv + 1, request->argv + 3, request->argc * sizeof(const char *));
+            }
+        }
+    }
+
+    return error;
+}
+
+// remove pending request at index
+Request *take_pending(int index);
+Request *take_pending(int index)
+{
+    Request *request = pending[index];
+
+    pending_count--;
+    memmove(pending + index, pending + index + 1, (pending_count - index) * sizeof(Request *));
+
+    return request;
+}
+
+// index of pending request to run next, or -1
+int next_pending(void);
+int next_pending(void)
+{
+    int next = -1;
+
+    for (int k = 0; k < pending_count; k++) {
+        if (next < 0 || pending[k]->priority > pending[next]->priority) next = k;
+    }
+
+    return next;
+}
+
+// queue request to be run, or drop it, according to busy_policy
+void add_request(Request *request);
+void add_request(Request *request)
+{
+    bool dropped = false;
+
+    if (busy_policy == BP_DROP) {
+        // it runs when what is playing and waiting is done, or preempts it
+        dropped = running != NULL && request->priority <= running->priority;
+
+        for (int k = pending_count - 1; k >= 0 && !dropped; k--) {
+            if (pending[k]->priority >= request->priority) {
+                dropped = true;
+
+            } else {
+                finish_request(take_pending(k), SE_BUSY);
+            }
+        }
+
+    } else if (pending_count == MAX_PENDING_REQUESTS) {
+        // make room by dropping the request that would be run last, if it isn't this one
+        int last = 0;
+        for (int k = 1; k < pending_count; k++) {
+            if (pending[k]->priority <= pending[last]->priority) last = k;
+        }
+
+        dropped = request->priority <= pending[last]->priority;
+        if (!dropped) finish_request(take_pending(last), SE_BUSY);
+    }
+
+    if (dropped) {
+        finish_request(request, SE_BUSY);
+
+    } else {
+        pending[pending_count++] = request;
+    }
+}
+
+// remove request at index of those being received
+Request *take_receiving(int index);
+Request *take_receiving(int index)
+{
+    Request *request = receiving[index];
+
+    receiving_count--;
+    memmove(receiving + index, receiving + index + 1, (receiving_count - index) * sizeof(Request *));
+
+    return request;
+}
+
+// receive what has arrived of request at index of those being received; once all of it has
+// arrived, it waits to be run
+void receive_more(int index);
+void receive_more(int index)
+{
+    Request *request = receiving[index];
+    bool complete = false;
+
+    SoundError result = receive_request(request->connection, request->text, &request->size, request->fds, &complete);
+    if (result == SE_NO_ERROR && complete) result = parse_request(request, request->size);
+
+    if (result != SE_NO_ERROR) {
+        finish_request(take_receiving(index), result);
+
+    } else if (complete) {
+        add_request(take_receiving(index));
+    }
+}
+
+// accept connection from client; its request is received as it arrives
+SoundError accept_request(void);
+SoundError accept_request(void)
+{
+    SoundError error = SE_NO_ERROR;
+    int connection = accept(listener, NULL, NULL);
+
+    if (connection >= 0) {
+        struct timeval timeout = { REQUEST_TIMEOUT_MSEC / 1000, (REQUEST_TIMEOUT_MSEC % 1000) * 1000 };
+        Request *request = new_request(connection);
+
+        if (request == NULL) {
+            close(connection);
+
+        } else {
+            request->text = (char *)malloc(MAX_REQUEST_SIZE);
+            gettimeofday(&request->deadline, NULL);
+            timeradd(&request->deadline, &timeout, &request->deadline);
+
+            if (request->text == NULL) {
+                finish_request(request, SE_OUT_OF_MEMORY);
+
+            } else if (!set_non_blocking(connection)) {
+                finish_request(request, SE_SOCKET_ERROR);
+
+            } else {
+                receiving[receiving_count++] = request;
+                receive_more(receiving_count - 1);
+            }
+        }
+
+    } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK) {
+        // a client that went away before it was accepted isn't an error
+        error = SE_SOCKET_ERROR;
+    }
+
+    return error;
+}
+
+// drop requests that haven't all arrived by their deadlines; returns milliseconds until the next
+// deadline, or -1 if there is none
+int expire_requests(void);
+int expire_requests(void)
+{
+    struct timeval now;
+    int next_msec = -1;
+
+    gettimeofday(&now, NULL);
+
+    for (int k = receiving_count - 1; k >= 0; k--) {
+        struct timeval left;
+
+        if (timercmp(&now, &receiving[k]->deadline, >)) {
+            finish_request(take_receiving(k), SE_SOCKET_ERROR);
+
+        } else {
+            timersub(&receiving[k]->deadline, &now, &left);
+            int msec = (int)(left.tv_sec * 1000 + left.tv_usec / 1000) + 1;
+            if (next_msec < 0 || msec < next_msec) next_msec = msec;
+        }
+    }
+
+    return next_msec;
+}
+
+// Split line of options (length bytes) into NUL-terminated strings in text, which has room for
+// length + 1 bytes; returns the number of bytes used. Options are separated by spaces or tabs, and
+// an option containing spaces can be quoted with "" or ''.
+size_t split_options(const char *line, size_t length, char *text)
+{
+    size_t size = 0;
+    bool in_option = false;
+    char quote = '\0';
+
+    for (size_t k = 0; k < length; k++) {
+        char c = line[k];
+
+        if (quote != '\0' && c == quote) {
+            quote = '\0';
+
+        } else if (quote == '\0' && (c == '"' || c == '\'')) {
+            quote = c;
+            in_option = true;
+
+        } else if (quote == '\0' && (c == ' ' || c == '\t' || c == '\r')) {
+            if (in_option) text[size++] = '\0';
+            in_option = false;
+
+        } else {
+            text[size++] = c;
+            in_option = true;
+        }
+    }
+
+    if (in_option) text[size++] = '\0';
+
+    return size;
+}
+
+// run options split by split_options() (size bytes) with handler, as a request of the daemon's own;
+// with no options, a single tone is played (-p)
+SoundError run_split_options(const char *options, size_t size, RequestHandler handler)
+{
+    SoundError error = SE_NO_ERROR;
+    int argc = 1;
+
+    for (size_t k = 0; k < size; k++) {
+        if (options[k] == '\0') argc++;
+    }
+
+    const char **argv = (const char **)malloc((argc + 2) * sizeof(const char *));
+    if (argv == NULL) error = SE_OUT_OF_MEMORY;
+
+    if (error == SE_NO_ERROR) {
+        int n = 0;
+
+        argv[n++] = PROGRAM_NAME;
+        for (size_t k = 0; k < size; k += strlen(options + k) + 1) argv[n++] = options + k;
+        if (argc == 1) argv[argc++] = DEFAULT_OPTIONS;
+        argv[argc] = NULL;
+
+        error = handler(argc, argv);
+    }
+
+    free(argv);
+
+    return error;
+}
+
+// read what is available from fd, and pass each complete line to handler; returns what read()
+// returned
+ssize_t read_lines(LineBuffer *lines, int fd, LineHandler handler)
+{
+    ssize_t received = read(fd, lines->text + lines->length, lines->size - lines->length);
+
+    if (received > 0) {
+        size_t start = 0;
+
+        lines->length += (size_t)received;
+
+        for (size_t k = lines->length - (size_t)received; k < lines->length; k++) {
+            if (lines->text[k] == '\n') {
+                lines->text[k] = '\0';
+                handler(lines->text + start, k - start, true);
+                start = k + 1;
+            }
+        }
+
+        memmove(lines->text, lines->text + start, lines->length - start);
+        lines->length -= start;
+
+        if (lines->length == lines->size) {
+            lines->text[lines->size] = '\0';
+            handler(lines->text, lines->size, false);
+            lines->length = 0;
+        }
+    }
+
+    return received;
+}
+
+// at end of input, pass the last line to handler even if it has no newline
+void finish_lines(LineBuffer *lines, LineHandler handler)
+{
+    if (lines->length > 0) {
+        lines->text[lines->length] = '\0';
+        handler(lines->text, lines->length, true);
+    }
+
+    lines->length = 0;
+}
+
+// print error of options that the daemon ran as its own, as there is no client to report it to;
+// being stopped isn't an error
+void report_error(SoundError error)
+{
+    if (error != SE_NO_ERROR && error != SE_PREEMPTED) fprintf(stderr, "Error: %s\n", sound_error_text(error));
+}
+
+// A request read from standard input is a line of options (see split_options()). Requests from
+// standard input are run in the daemon's working directory, and can't read standard input
+// themselves: one with -I is answered with SE_INVALID_OPTION.
+void add_input_request(const char *line, size_t length);
+void add_input_request(const char *line, size_t length)
+{
+    size_t size = strlen(PROGRAM_NAME) + 1;
+    Request *request = new_request(-1);
+    SoundError result = SE_NO_ERROR;
+
+    if (request != NULL) request->text = (char *)malloc(size + length + 1);
+
+    if (request == NULL || request->text == NULL) {
+        fprintf(stderr, "Error: %s\n", sound_error_text(SE_OUT_OF_MEMORY));
+        if (request != NULL) free(request);
+
+    } else {
+        size_t options_size = split_options(line, length, request->text + size);
+
+        memcpy(request->text, PROGRAM_NAME, size);
+        if (options_size > 0) result = parse_request(request, size + options_size);
+
+        // -I would read the requests that follow
+        for (int k = 1; k < request->argc && result == SE_NO_ERROR; k++) {
+            if (strcmp(request->argv[k], "-I") == 0) result = SE_INVALID_OPTION;
+        }
+
+        // blank lines are ignored
+        if (options_size == 0) {
+            free(request->text);
+            free(request);
+
+        } else if (result == SE_NO_ERROR) {
+            add_request(request);
+
+        } else {
+            finish_request(request, result);
+        }
+    }
+}
+
+void add_input_line(char *line, size_t length, bool complete);
+void add_input_line(char *line, size_t length, bool complete)
+{
+    if (complete) {
+        add_input_request(line, length);
+
+    } else {
+        // a line too long to be a request
+        fprintf(stderr, "Error: %s\n", sound_error_text(SE_INVALID_VALUE));
+    }
+}
+
+// read what is available from standard input, and add a request for each complete line; at end
+// of input, the last line is added even if it isn't complete
+void read_input(void);
+void read_input(void)
+{
+    ssize_t received = read_lines(&input_lines, STDIN_FILENO, add_input_line);
+
+    if (received == 0 || (received < 0 && errno != EINTR)) {
+        finish_lines(&input_lines, add_input_line);
+        reading_input = false;
+    }
+}
+
+// add requests that have arrived, waiting up to timeout milliseconds (-1 for no limit) for one;
+// never waits for a client that is slow to send its request
+SoundError collect_requests(int timeout);
+SoundError collect_requests(int timeout)
+{
+    SoundError error = SE_NO_ERROR;
+    struct pollfd fds[2 + MAX_RECEIVING_REQUESTS];
+    Request *polled[2 + MAX_RECEIVING_REQUESTS];
+    nfds_t count = 0;
+
+    // until the next request being received is due
+    int next_msec = expire_requests();
+    if (next_msec >= 0 && (timeout < 0 || next_msec < timeout)) timeout = next_msec;
+
+    // with no room to receive another request, it waits to be accepted
+    if (listener >= 0 && receiving_count < MAX_RECEIVING_REQUESTS) {
+        fds[count].fd = listener;
+        fds[count].events = POLLIN;
+        polled[count] = NULL;
+        count++;
+    }
+
+    if (reading_input) {
+        fds[count].fd = STDIN_FILENO;
+        fds[count].events = POLLIN;
+        polled[count] = NULL;
+        count++;
+    }
+
+    for (int k = 0; k < receiving_count; k++) {
+        fds[count].fd = receiving[k]->connection;
+        fds[count].events = POLLIN;
+        polled[count] = receiving[k];
+        count++;
+    }
+
+    if (count > 0 && poll(fds, count, timeout) > 0) {
+        for (nfds_t k = 0; k < count && error == SE_NO_ERROR; k++) {
+            if (fds[k].revents == 0) {
+                // nothing from this one
+
+            } else if (polled[k] != NULL) {
+                // requests before it may have been received in the meantime
+                for (int index = 0; index < receiving_count; index++) {
+                    if (receiving[index] == polled[k]) {
+                        receive_more(index);
+                        break;
+                    }
+                }
+
+            } else if (fds[k].fd == listener) {
+                error = accept_request();
+
+            } else {
+                read_input();
+            }
+        }
+    }
+
+    expire_requests();
+
+    return error;
+}
+
+// called while a request is playing: stop it if the daemon is stopping, or if a request with a
+// higher priority is waiting
+bool preempt_requested(void);
+bool preempt_requested(void)
+{
+    collect_requests(0);
+
+    int next = next_pending();
+
+    return daemon_stopping || (next >= 0 && running != NULL && pending[next]->priority > running->priority);
+}
+
+// Serve requests on Unix domain socket at path, or from standard input if path is "-", until
+// SIGINT or SIGTERM (or the end of standard input). A socket left by a daemon that is no longer
+// running is replaced; if a daemon is listening on it, returns SE_SOCKET_ERROR.
+SoundError serve_requests(const char *path, BusyPolicy policy, RequestHandler handler)
+{
+    struct sockaddr_un address;
+    struct stat status;
+    bool bound = false;
+    SoundError error = SE_NO_ERROR;
+
+    busy_policy = policy;
+    reading_input = strcmp(path, "-") == 0;
+
+    if (!reading_input) {
+        error = socket_address(path, &address);
+
+        if (error == SE_NO_ERROR) {
+            int existing = connect_socket(&address);
+
+            if (existing >= 0) {
+                close(existing);
+                error = SE_SOCKET_ERROR;
+
+            } else if (lstat(path, &status) == 0 && S_ISSOCK(status.st_mode)) {
+                unlink(path);
+            }
+        }
+
+        if (error == SE_NO_ERROR) {
+            listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            bound = listener >= 0 && bind(listener, (const struct sockaddr *)&address, sizeof(address)) == 0;
+            if (!bound || listen(listener, SOMAXCONN) != 0 || !set_non_blocking(listener)) error = SE_SOCKET_ERROR;
+        }
+    }
+
+    if (error == SE_NO_ERROR) catch_stop_signals();
+
+    while (error == SE_NO_ERROR && !daemon_stopping && (listener >= 0 || reading_input || pending_count > 0)) {
+        if (pending_count == 0) error = collect_requests(-1);
+
+        if (error == SE_NO_ERROR && pending_count > 0 && !daemon_stopping) {
+            running = take_pending(next_pending());
+
+            set_preempt_check(preempt_requested);
+            SoundError result = run_as_client(handler, running->argc, running->argv, running->fds);
+            set_preempt_check(NULL);
+
+            finish_request(running, result);
+            running = NULL;
+        }
+    }
+
+    while (receiving_count > 0) finish_request(take_receiving(0), SE_BUSY);
+    while (pending_count > 0) finish_request(take_pending(0), SE_BUSY);
+
+    if (listener >= 0) close(listener);
+    listener = -1;
+    if (bound) unlink(path);
+
+    return error;
+}
+
+// send options to daemon listening at path, and wait until they have been run; *result is the
+// daemon's result
+SoundError send_request(const char *path, int count, const char *options[], SoundError *result)
+{
+    struct sockaddr_un address;
+    int connection = -1;
+    int fds[PASSED_FDS] = { -1, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char *request = NULL;
+    size_t size = 0;
+
+    SoundError error = socket_address(path, &address);
+
+    size = strlen(PROGRAM_NAME) + 1;
+    for (int k = 0; k < count; k++) size += strlen(options[k]) + 1;
+    if (error == SE_NO_ERROR && size > MAX_REQUEST_SIZE) error = SE_INVALID_VALUE;
+
+    if (error == SE_NO_ERROR) {
+        request = (char *)malloc(size);
+        if (request == NULL) error = SE_OUT_OF_MEMORY;
+    }
+
+    if (error == SE_NO_ERROR) {
+        char *p = request;
+
+        memcpy(p, PROGRAM_NAME, strlen(PROGRAM_NAME) + 1);
+        p += strlen(PROGRAM_NAME) + 1;
+
+        for (int k = 0; k < count; k++) {
+            size_t length = strlen(options[k]) + 1;
+            memcpy(p, options[k], length);
+            p += length;
+        }
+
+        fds[0] = open(".", O_RDONLY);
+        if (fds[0] < 0) error = SE_INPUT_FILE_OPEN_ERROR;
+    }
+
+    if (error == SE_NO_ERROR) {
+        connection = connect_socket(&address);
+        if (connection < 0) error = SE_SOCKET_ERROR;
+    }
+
+    // a daemon that goes away is reported as SE_SOCKET_ERROR
+    signal(SIGPIPE, SIG_IGN);
+
+    if (error == SE_NO_ERROR) {
+        union {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(PASSED_FDS * sizeof(int))];
+        } control;
+        struct iovec iov = { request, size };
+        struct msghdr message;
+
+        memset(&control, 0, sizeof(control));
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.space;
+        message.msg_controllen = sizeof(control.space);
+
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(PASSED_FDS * sizeof(int));
+        memcpy(CMSG_DATA(header), fds, PASSED_FDS * sizeof(int));
+
+        ssize_t sent = sendmsg(connection, &message, 0);
+
+        // rest of request, if it didn't all go at once
+        for (size_t done = 0; sent > 0 && (done += (size_t)sent) < size; ) {
+            sent = send(connection, request + done, size - done, 0);
+        }
+
+        if (sent < 0 || shutdown(connection, SHUT_WR) != 0) error = SE_SOCKET_ERROR;
+    }
+
+    if (error == SE_NO_ERROR) {
+        char reply[REPLY_SIZE];
+        size_t length = 0;
+        ssize_t received = 1;
+        char *end = NULL;
+
+        while (received > 0 && length < sizeof(reply) - 1) {
+            received = recv(connection, reply + length, sizeof(reply) - 1 - length, 0);
+            if (received > 0) length += (size_t)received;
+        }
+
+        reply[length] = '\0';
+        long value = strtol(reply, &end, 10);
+
+        if (received < 0 || end == reply || *end != '\n') {
+            error = SE_SOCKET_ERROR;
+
+        } else {
+            *result = (SoundError)value;
+        }
+    }
+
+    if (connection >= 0) close(connection);
+    if (fds[0] >= 0) close(fds[0]);
+    free(request);
+
+    return error;
+}
@@ -0,0 +1,75 @@
+//
+// daemon.h
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef daemon_h
+#define daemon_h
+
+#include <sys/types.h>
+
+#include "sound.h"
+
+// Daemon mode: the sound device is opened once, and requests from clients are run one at a time
+// as they arrive on a Unix domain socket (or as lines of standard input). A request is a list of
+// command-line options, run with the client's working directory and standard input, output and
+// error, so that it behaves as it would on the command line. A request may start with
+// "--priority N"; one with a higher priority than the request playing preempts it.
+
+// argv[0] of requests, and of options run by the daemon's own
+#define PROGRAM_NAME "mbeep"
+
+// what happens to a request that arrives while another is playing, if it doesn't preempt it
+typedef enum BusyPolicy {
+    BP_QUEUE = 0,       // wait until the device is free
+    BP_DROP             // drop it (SE_BUSY)
+} BusyPolicy;
+
+// runs the options of one request; argv[0] is the program name, as for main()
+typedef SoundError (*RequestHandler)(int argc, const char *argv[]);
+
+// Lines read from a descriptor as they arrive (standard input, events or a watched file). text has
+// room for size + 1 bytes; length bytes of an incomplete line are kept until the rest arrives.
+struct LineBuffer {
+    char *text;
+    size_t size;
+    size_t length;
+};
+typedef struct LineBuffer LineBuffer;
+
+// called with each line read, NUL-terminated and without its newline; a line longer than the
+// buffer is passed on in pieces, which aren't complete
+typedef void (*LineHandler)(char *line, size_t length, bool complete);
+
+SoundError serve_requests(const char *path, BusyPolicy policy, RequestHandler handler);
+size_t split_options(const char *line, size_t length, char *text);
+SoundError run_split_options(const char *options, size_t size, RequestHandler handler);
+ssize_t read_lines(LineBuffer *lines, int fd, LineHandler handler);
+void finish_lines(LineBuffer *lines, LineHandler handler);
+void report_error(SoundError error);
+void catch_stop_signals(void);
+bool stop_requested(void);
+SoundError send_request(const char *path, int count, const char *options[], SoundError *result);
+
+#endif /* daemon_h */
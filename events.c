@@ -0,0 +1,319 @@
+//
+// events.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// for clock_gettime()
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "events.h"
+
+// Reading and coalescing events costs little per event, and options are only copied for the first
+// event of a window, so a storm of events is mostly counted. What is played is bounded by the
+// token buckets: with MAX_EVENT_CLASSES classes, at most MAX_EVENT_CLASSES * burst plays at
+// once, then MAX_EVENT_CLASSES * per_minute a minute. Once there are MAX_EVENT_CLASSES classes, a
+// new class takes the place of one with no events waiting: preferably one whose bucket has filled
+// up again, so that forgetting it changes nothing, otherwise the one that has gone longest without
+// an event. Events of a new class are dropped, and reported, only while every class has events
+// waiting. Events are read while others are played, so whatever writes them is never held up.
+#define MAX_EVENT_CLASSES 64
+#define MAX_EVENT_LINE 4096
+#define COUNT_SIZE 24
+
+struct EventClass {
+    char *name;
+    char *options;          // options of first event of window, each NUL-terminated
+    size_t options_size;
+    uint64_t count;         // events waiting to be played
+    double play_time;       // when they are played (seconds of CLOCK_MONOTONIC)
+    double tokens;
+    double refill_time;     // when tokens were last added
+    double event_time;      // when its last event arrived
+};
+typedef struct EventClass EventClass;
+
+EventClass event_classes[MAX_EVENT_CLASSES];
+int event_class_count = 0;
+uint64_t dropped_events = 0;   // not yet reported
+EventLimits event_limits;
+
+int event_fd = -1;
+bool reading_events = false;
+char event_text[MAX_EVENT_LINE + 1];
+LineBuffer event_lines = { event_text, MAX_EVENT_LINE, 0 };
+
+double monotonic_seconds(void);
+double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+void add_tokens(EventClass *event_class, double now);
+
+// class with no events waiting that can make way for a new one, preferring one with a full bucket;
+// NULL if every class has events waiting
+EventClass *reclaim_event_class(double now);
+EventClass *reclaim_event_class(double now)
+{
+    EventClass *refilled = NULL;
+    EventClass *oldest = NULL;
+
+    for (int k = 0; k < event_class_count && refilled == NULL; k++) {
+        EventClass *event_class = &event_classes[k];
+
+        if (event_class->count == 0) {
+            add_tokens(event_class, now);
+            if (event_class->tokens >= event_limits.burst) refilled = event_class;
+
+            if (oldest == NULL || event_class->event_time < oldest->event_time) oldest = event_class;
+        }
+    }
+
+    return refilled != NULL ? refilled : oldest;
+}
+
+// class with name, added if it is new, in place of another if there are already MAX_EVENT_CLASSES;
+// NULL if there is no room for it
+EventClass *find_event_class(const char *name, double now);
+EventClass *find_event_class(const char *name, double now)
+{
+    EventClass *event_class = NULL;
+
+    for (int k = 0; k < event_class_count && event_class == NULL; k++) {
+        if (strcmp(event_classes[k].name, name) == 0) event_class = &event_classes[k];
+    }
+
+    if (event_class == NULL) {
+        char *copy = strdup(name);
+
+        if (copy != NULL && event_class_count < MAX_EVENT_CLASSES) {
+            event_class = &event_classes[event_class_count++];
+
+        } else if (copy != NULL) {
+            event_class = reclaim_event_class(now);
+
+            if (event_class != NULL) {
+                free(event_class->name);
+                free(event_class->options);
+            }
+        }
+
+        if (event_class == NULL) {
+            free(copy);
+
+        } else {
+            memset(event_class, 0, sizeof(EventClass));
+            event_class->name = copy;
+            event_class->tokens = event_limits.burst;
+            event_class->refill_time = now;
+        }
+    }
+
+    return event_class;
+}
+
+// count event of line (length bytes), starting a window if it is the first of its class
+void add_event(const char *line, size_t length, double now);
+void add_event(const char *line, size_t length, double now)
+{
+    char text[MAX_EVENT_LINE + 1];
+    size_t size = split_options(line, length, text);
+    EventClass *event_class = size > 0 ? find_event_class(text, now) : NULL;
+
+    if (event_class != NULL && event_class->count == 0) {
+        size_t name_size = strlen(text) + 1;
+
+        free(event_class->options);
+        event_class->options_size = size - name_size;
+        event_class->options = (char *)malloc(event_class->options_size + 1);
+
+        if (event_class->options != NULL) {
+            memcpy(event_class->options, text + name_size, event_class->options_size);
+            event_class->play_time = now + 0.001 * event_limits.window_msec;
+        }
+    }
+
+    if (event_class != NULL && event_class->options != NULL) {
+        event_class->count++;
+        event_class->event_time = now;
+
+    } else if (size > 0) {
+        dropped_events++;
+    }
+}
+
+void add_event_line(char *line, size_t length, bool complete);
+void add_event_line(char *line, size_t length, bool complete)
+{
+    // a line too long to be an event is ignored
+    if (complete) add_event(line, length, monotonic_seconds());
+}
+
+// read what is available, and add an event for each complete line; at end of input, the last line
+// is added even if it isn't complete
+void read_events(void);
+void read_events(void)
+{
+    ssize_t received = read_lines(&event_lines, event_fd, add_event_line);
+
+    if (received == 0 || (received < 0 && errno != EINTR)) {
+        finish_lines(&event_lines, add_event_line);
+        reading_events = false;
+    }
+}
+
+// wait up to timeout milliseconds (-1 for no limit) for events, and read them
+void wait_for_events(int timeout);
+void wait_for_events(int timeout)
+{
+    struct pollfd fds = { event_fd, POLLIN, 0 };
+
+    if (poll(&fds, reading_events ? 1 : 0, timeout) > 0) read_events();
+}
+
+// called while events are played, so that events go on being read
+bool read_while_playing(void);
+bool read_while_playing(void)
+{
+    if (reading_events) wait_for_events(0);
+
+    return stop_requested();
+}
+
+void add_tokens(EventClass *event_class, double now)
+{
+    event_class->tokens += (now - event_class->refill_time) * event_limits.per_minute / 60.0;
+    if (event_class->tokens > event_limits.burst) event_class->tokens = event_limits.burst;
+    event_class->refill_time = now;
+}
+
+// play events of class: their options, then their count if there is more than one
+void play_events(EventClass *event_class, RequestHandler handler);
+void play_events(EventClass *event_class, RequestHandler handler)
+{
+    // events that arrive while these are played start a new window
+    char *options = event_class->options;
+    size_t options_size = event_class->options_size;
+    uint64_t count = event_class->count;
+
+    event_class->options = NULL;
+    event_class->count = 0;
+
+    set_preempt_check(read_while_playing);
+    SoundError error = run_split_options(options, options_size, handler);
+
+    if (error == SE_NO_ERROR && count > 1) {
+        char count_text[COUNT_SIZE];
+        const char *summary[] = { PROGRAM_NAME, "-c", count_text, NULL };
+
+        snprintf(count_text, sizeof(count_text), "%llu", (unsigned long long)count);
+        error = handler(3, summary);
+    }
+
+    set_preempt_check(NULL);
+
+    report_error(error);
+
+    free(options);
+}
+
+// Read events from file at path, or from standard input if path is "-", and play them as limited,
+// until SIGINT or SIGTERM, or until the end of the input, after which the events still waiting are
+// played right away.
+SoundError ingest_events(const char *path, const EventLimits *limits, RequestHandler handler)
+{
+    SoundError error = SE_NO_ERROR;
+
+    event_limits = *limits;
+    event_fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    reading_events = event_fd >= 0;
+
+    if (event_fd < 0) error = SE_INPUT_FILE_OPEN_ERROR;
+
+    if (error == SE_NO_ERROR) catch_stop_signals();
+
+    while (error == SE_NO_ERROR && !stop_requested()) {
+        double now = monotonic_seconds();
+        EventClass *next = NULL;
+
+        for (int k = 0; k < event_class_count; k++) {
+            EventClass *event_class = &event_classes[k];
+
+            if (event_class->count > 0 && (next == NULL || event_class->play_time < next->play_time)) {
+                next = event_class;
+            }
+        }
+
+        // once for events dropped since the last report, however many there are
+        if (dropped_events > 0) {
+            fprintf(stderr, "Error: %s: %llu events dropped\n", sound_error_text(SE_BUSY),
+                    (unsigned long long)dropped_events);
+            dropped_events = 0;
+        }
+
+        if (next == NULL && !reading_events) break;
+
+        // at end of input, there is nothing more to coalesce or to wait for
+        if (next != NULL && (next->play_time <= now || !reading_events)) {
+            add_tokens(next, now);
+
+            if (next->tokens >= 1.0 || !reading_events) {
+                if (next->tokens >= 1.0) next->tokens -= 1.0;
+                play_events(next, handler);
+
+            } else {
+                // wait for next token
+                next->play_time = now + (1.0 - next->tokens) * 60.0 / event_limits.per_minute;
+            }
+
+        } else {
+            wait_for_events(next == NULL ? -1 : (int)ceil(1000.0 * (next->play_time - now)));
+        }
+    }
+
+    for (int k = 0; k < event_class_count; k++) {
+        free(event_classes[k].name);
+        free(event_classes[k].options);
+    }
+
+    event_class_count = 0;
+    dropped_events = 0;
+    if (event_fd >= 0 && event_fd != STDIN_FILENO) close(event_fd);
+    event_fd = -1;
+
+    return error;
+}
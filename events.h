@@ -0,0 +1,49 @@
+//
+// events.h
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef events_h
+#define events_h
+
+#include "daemon.h"
+
+// Event mode: lines describing events are read as they arrive, and each kind of event is played
+// at most at a limited rate, however many events there are. An event line is "CLASS [OPTIONS]":
+// the class is any word naming the kind of event, and the options are how to play it (-p, a
+// single tone, if none are given). Events of a class that arrive within a window of the first are
+// played once, followed by their count in Morse code if there is more than one. Each class has a
+// token bucket: a window whose class has no token left waits for one, counting the events that
+// arrive meanwhile.
+
+struct EventLimits {
+    double window_msec;     // events of a class within this time of the first are played together
+    double per_minute;      // rate at which a class gets tokens
+    double burst;           // tokens a class can save up
+};
+typedef struct EventLimits EventLimits;
+
+SoundError ingest_events(const char *path, const EventLimits *limits, RequestHandler handler);
+
+#endif /* events_h */
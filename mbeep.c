@@ -24,21 +24,35 @@
 // WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
+// for clock_gettime()
+#define _DEFAULT_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#define __USE_POSIX199309
-#define __USE_XOPEN2K
 #include <time.h>
+#include <unistd.h>
 
+#include "cache.h"
+#include "daemon.h"
+#include "events.h"
 #include "patterns.h"
+#include "program.h"
 #include "sound.h"
 #include "text.h"
+#include "tonecache.h"
+#include "watch.h"
 
 #define LINE_SIZE 1024
 #define DEFAULT_WPM 20.0
+#define DEFAULT_EVENT_WINDOW_MSEC 1000.0
+#define DEFAULT_EVENTS_PER_MINUTE 12.0
+#define DEFAULT_EVENT_BURST 3.0
 
 // only available for macOS >= 10.12
 #define USE_CLOCK_MONOTONIC 0
@@ -47,10 +61,35 @@
 #include <sys/time.h>
 #endif
 
-int main(int argc, const char * argv[]) {
+SoundError run_daemon_request(int argc, const char *argv[]);
+
+// size limit in bytes given by --cache-size value (megabytes); false if value isn't a whole number
+// of megabytes greater than 0
+bool parse_cache_size(const char *value, uint64_t *size);
+bool parse_cache_size(const char *value, uint64_t *size)
+{
+    char *end;
+
+    errno = 0;
+    long long mbytes = strtoll(value, &end, 10);
+    bool valid = end != value && *end == '\0' && errno == 0 && mbytes > 0 &&
+                 (unsigned long long)mbytes <= (UINT64_MAX >> 20);
+
+    if (valid) *size = (uint64_t)mbytes << 20;
+
+    return valid;
+}
+
+// process options in order, playing tones as they are specified; if counting, samples that would
+// be written to the .wav file are counted (see begin_sample_count()), and nothing is played or
+// written. If initialized, sound is already set up (by the daemon), and options that set up the
+// device are not allowed.
+SoundError run_options(int argc, const char *argv[], bool counting, bool initialized);
+SoundError run_options(int argc, const char *argv[], bool counting, bool initialized)
+{
     SoundError error = SE_NO_ERROR;
 
-    bool needs_init = true;
+    bool needs_init = !initialized;
     double freq = DEFAULT;
     double msec = 200.0;
     int repeats = 1;
@@ -65,6 +104,9 @@ int main(int argc, const char * argv[]) {
     bool do_final_play = true;
     bool echo = false;
     bool print_fcc_wpm = false;
+    bool compiling = false;
+    BusyPolicy busy_policy = BP_QUEUE;
+    EventLimits event_limits = { DEFAULT_EVENT_WINDOW_MSEC, DEFAULT_EVENTS_PER_MINUTE, DEFAULT_EVENT_BURST };
 
     FILE *in_file = NULL;
     FILE *out_file = NULL;
@@ -94,7 +136,7 @@ int main(int argc, const char * argv[]) {
         //  -p  (play)
         } else if (strcmp(argv[index], "-p") == 0) {
             if (needs_init) {
-                error = init_sound();
+                if (!counting) error = init_sound();
                 needs_init = false;
             }
 
@@ -110,7 +152,7 @@ int main(int argc, const char * argv[]) {
             const char *str = argv[++index];
 
             if (needs_init) {
-                error = init_sound();
+                if (!counting) error = init_sound();
                 needs_init = false;
             }
 
@@ -123,7 +165,7 @@ int main(int argc, const char * argv[]) {
         //  -m  (send input file as midi notes)
         } else if (strcmp(argv[index], "-m") == 0 && in_file != NULL) {
             if (needs_init) {
-                error = init_sound();
+                if (!counting) error = init_sound();
                 needs_init = false;
             }
 
@@ -183,7 +225,7 @@ int main(int argc, const char * argv[]) {
         //  -c  string to send as Morse code
         } else if (strcmp(argv[index], "-c") == 0 && index + 1 < argc) {
             if (needs_init) {
-                error = init_sound();
+                if (!counting) error = init_sound();
                 needs_init = false;
             }
 
@@ -230,7 +272,7 @@ int main(int argc, const char * argv[]) {
             double elapsed = (double)(te.tv_sec - ts.tv_sec) + 1e-6 * (te.tv_usec - ts.tv_usec);
 #endif
 
-            if (print_fcc_wpm) {
+            if (print_fcc_wpm && !counting) {
                 fprintf(stderr, "Elapsed %.1f seconds\nFCC char count %d\nFCC wpm %.1f\n", elapsed, fcc_char_count,
                         (fcc_char_count / 5.0) / (elapsed / 60.0));
             }
@@ -238,7 +280,7 @@ int main(int argc, const char * argv[]) {
         //  -c  (send input file as Morse code)
         } else if (strcmp(argv[index], "-c") == 0 && in_file != NULL) {
             if (needs_init) {
-                error = init_sound();
+                if (!counting) error = init_sound();
                 needs_init = false;
             }
 
@@ -287,7 +329,7 @@ int main(int argc, const char * argv[]) {
             double elapsed = (double)(te.tv_sec - ts.tv_sec) + 1e-6 * (te.tv_usec - ts.tv_usec);
 #endif
 
-            if (print_fcc_wpm) {
+            if (print_fcc_wpm && !counting) {
                 fprintf(stderr, "Elapsed %.1f seconds\nFCC char count %d\nFCC wpm %.1f\n", elapsed, fcc_char_count,
                        (fcc_char_count / 5.0) / (elapsed / 60.0));
             }
@@ -313,10 +355,10 @@ int main(int argc, const char * argv[]) {
                 error = SE_INPUT_FILE_OPEN_ERROR;
             }
 
-        //  --play  play .wav file (for testing files written by mbeep)
+        //  --play  play .wav file
         } else if (strcmp(argv[index], "--play") == 0 && index + 1 < argc) {
             if (needs_init) {
-                error = init_sound();
+                if (!counting) error = init_sound();
                 needs_init = false;
             }
 
@@ -327,6 +369,14 @@ int main(int argc, const char * argv[]) {
             
             if (error == SE_NO_ERROR) error = wait_for_buffers();
 
+        //  --stream  play following tones on stream N, mixed with the others
+        } else if (strcmp(argv[index], "--stream") == 0 && index + 1 < argc) {
+            error = select_stream(atoi(argv[++index]));
+
+        //  --stop-stream  stop background stream N now
+        } else if (strcmp(argv[index], "--stop-stream") == 0 && index + 1 < argc) {
+            error = stop_stream(atoi(argv[++index]));
+
         //  -I  use stdin for midi or code string (same as -i /dev/stdin)
         } else if (strcmp(argv[index], "-I") == 0) {
             if (in_file != NULL) {
@@ -340,24 +390,219 @@ int main(int argc, const char * argv[]) {
                 error = SE_INPUT_FILE_OPEN_ERROR;
             }
 
+        //  --device  name of audio output device (before any tones are played)
+        } else if (strcmp(argv[index], "--device") == 0 && index + 1 < argc && needs_init) {
+            set_sound_device(argv[++index]);
+
+        //  --rate  sample rate in Hz, or "native" for device's own rate (before any tones are played)
+        } else if (strcmp(argv[index], "--rate") == 0 && index + 1 < argc && needs_init) {
+            const char *rate = argv[++index];
+            error = set_sample_rate(strcmp(rate, "native") == 0 ? 0 : (unsigned int)atoi(rate));
+
+        //  --synth-rate  rate tones are synthesized at, resampled to sample rate (before any tones are played)
+        } else if (strcmp(argv[index], "--synth-rate") == 0 && index + 1 < argc && needs_init) {
+            error = set_synth_rate((unsigned int)atoi(argv[++index]));
+
+        //  --resample  quality of resampling: fast, medium, best, or device (for .wav files)
+        } else if (strcmp(argv[index], "--resample") == 0 && index + 1 < argc) {
+            const char *quality = argv[++index];
+
+            if (strcmp(quality, "fast") == 0) {
+                set_resample_quality(RQ_FAST);
+
+            } else if (strcmp(quality, "medium") == 0) {
+                set_resample_quality(RQ_MEDIUM);
+
+            } else if (strcmp(quality, "best") == 0) {
+                set_resample_quality(RQ_BEST);
+
+            } else if (strcmp(quality, "device") == 0) {
+                set_resample_quality(RQ_DEVICE);
+
+            } else {
+                error = SE_INVALID_VALUE;
+            }
+
+        //  --fixed-point  use fixed-point synthesis
+        } else if (strcmp(argv[index], "--fixed-point") == 0) {
+            set_fixed_point(true);
+
+        //  --floating-point  use floating-point synthesis
+        } else if (strcmp(argv[index], "--floating-point") == 0) {
+            set_fixed_point(false);
+
+        //  --loopback  render through loopback device and print statistics (for testing)
+        } else if (strcmp(argv[index], "--loopback") == 0 && needs_init) {
+            error = set_loopback(true);
+
+        //  --busy  what daemon does with a request that arrives while another is playing
+        } else if (strcmp(argv[index], "--busy") == 0 && index + 1 < argc && !initialized) {
+            const char *policy = argv[++index];
+
+            if (strcmp(policy, "queue") == 0) {
+                busy_policy = BP_QUEUE;
+
+            } else if (strcmp(policy, "drop") == 0) {
+                busy_policy = BP_DROP;
+
+            } else {
+                error = SE_INVALID_VALUE;
+            }
+
+        //  --daemon  open device, then run options sent by clients to socket (until SIGINT or SIGTERM)
+        } else if (strcmp(argv[index], "--daemon") == 0 && index + 1 < argc && !initialized) {
+            const char *path = argv[++index];
+
+            if (needs_init) {
+                if (!counting) error = init_sound();
+                needs_init = false;
+            }
+
+            if (error == SE_NO_ERROR && !counting) error = serve_requests(path, busy_policy, run_daemon_request);
+            do_final_play = false;
+
+        //  --window  time in msec within which events of a class are played together
+        } else if (strcmp(argv[index], "--window") == 0 && index + 1 < argc && !initialized) {
+            event_limits.window_msec = atof(argv[++index]);
+            if (event_limits.window_msec < 0.0) error = SE_INVALID_TIME;
+
+        //  --limit  plays per minute of each class of events
+        } else if (strcmp(argv[index], "--limit") == 0 && index + 1 < argc && !initialized) {
+            event_limits.per_minute = atof(argv[++index]);
+            if (event_limits.per_minute <= 0.0) error = SE_INVALID_VALUE;
+
+        //  --burst  plays of each class of events that can be saved up
+        } else if (strcmp(argv[index], "--burst") == 0 && index + 1 < argc && !initialized) {
+            event_limits.burst = atof(argv[++index]);
+            if (event_limits.burst < 1.0) error = SE_INVALID_VALUE;
+
+        //  --events  open device, then play events read from file, coalesced and rate-limited
+        } else if (strcmp(argv[index], "--events") == 0 && index + 1 < argc && !initialized) {
+            const char *path = argv[++index];
+
+            if (needs_init) {
+                if (!counting) error = init_sound();
+                needs_init = false;
+            }
+
+            if (error == SE_NO_ERROR && !counting) error = ingest_events(path, &event_limits, run_daemon_request);
+            do_final_play = false;
+
+        //  --on  options to play for lines of watched file that match pattern
+        } else if (strcmp(argv[index], "--on") == 0 && index + 2 < argc && !initialized) {
+            const char *pattern = argv[++index];
+            const char *options = argv[++index];
+
+            if (!counting) error = add_watch_pattern(pattern, options);
+
+        //  --watch  open device, then play lines written to file (until SIGINT or SIGTERM)
+        } else if (strcmp(argv[index], "--watch") == 0 && index + 1 < argc && !initialized) {
+            const char *path = argv[++index];
+
+            if (needs_init) {
+                if (!counting) error = init_sound();
+                needs_init = false;
+            }
+
+            if (error == SE_NO_ERROR && !counting) error = watch_file(path, run_daemon_request);
+            clear_watch_patterns();
+            do_final_play = false;
+
+        //  --tone-cache  share rendered tones with other processes in shared memory segment
+        } else if (strcmp(argv[index], "--tone-cache") == 0 && index + 1 < argc) {
+            error = attach_tone_cache(argv[++index]);
+
+        //  --compile  record tones played after this into tone program, instead of playing them
+        } else if (strcmp(argv[index], "--compile") == 0 && index + 1 < argc && !compiling) {
+            const char *path = argv[++index];
+
+            if (!counting) error = begin_program(path);
+            compiling = true;
+
+        //  --run  play tone program
+        } else if (strcmp(argv[index], "--run") == 0 && index + 1 < argc) {
+            const char *path = argv[++index];
+
+            if (needs_init) {
+                if (!counting) error = init_sound();
+                needs_init = false;
+            }
+
+            if (error == SE_NO_ERROR) error = run_program(path, out_file);
+
+            if (error == SE_NO_ERROR) error = play_buffers();
+            if (error == SE_NO_ERROR) error = wait_for_buffers();
+            do_final_play = false;
+
+        //  --cache  directory of rendered files, used by run_command()
+        } else if (strcmp(argv[index], "--cache") == 0 && index + 1 < argc) {
+            index++;
+
+        //  --cache-size  size limit of cache in megabytes
+        } else if (strcmp(argv[index], "--cache-size") == 0 && index + 1 < argc) {
+            uint64_t cache_size;
+            if (!parse_cache_size(argv[++index], &cache_size)) error = SE_INVALID_VALUE;
+
         //  -e  (echo)
         } else if (strcmp(argv[index], "-e") == 0) {
             echo = true;
 
-        //  -o --wav  output file for .wav
+        //  -o --wav  output file for .wav (- for standard output)
         } else if (((strcmp(argv[index], "-o") == 0) ||
                     (strcmp(argv[index], "--wav") == 0)) && index + 1 < argc && out_file == NULL) {
-            
-            out_file = fopen(argv[++index], "w");
+            const char *path = argv[++index];
+
+            if (counting || strcmp(path, "-") == 0) {
+                // nothing is written while counting, but tones after this go to the file
+                out_file = stdout;
+
+            } else {
+                // opened for reading too, so that it can be memory-mapped
+                out_file = fopen(path, "w+");
+            }
 
             if (out_file == NULL) {
                 error = SE_OUTPUT_FILE_OPEN_ERROR;
             }
 
-            if (error == SE_NO_ERROR) {
+            if (error == SE_NO_ERROR && !counting) {
                 error = begin_wave_file(out_file);
             }
 
+        //  --raw  write samples to output file without .wav header
+        } else if (strcmp(argv[index], "--raw") == 0) {
+            set_raw_output(true);
+
+        //  --format  format of .wav file samples
+        } else if (strcmp(argv[index], "--format") == 0 && index + 1 < argc) {
+            const char *format = argv[++index];
+
+            if (strcmp(format, "pcm16") == 0) {
+                error = set_output_format(SF_PCM16);
+
+            } else if (strcmp(format, "pcm24") == 0) {
+                error = set_output_format(SF_PCM24);
+
+            } else if (strcmp(format, "float") == 0) {
+                error = set_output_format(SF_FLOAT);
+
+            } else if (strcmp(format, "ulaw") == 0) {
+                error = set_output_format(SF_ULAW);
+
+            } else if (strcmp(format, "alaw") == 0) {
+                error = set_output_format(SF_ALAW);
+
+            } else if (strcmp(format, "adpcm") == 0) {
+                error = set_output_format(SF_ADPCM);
+
+            } else {
+                error = SE_INVALID_OPTION;
+            }
+
+        //  --dither  dither 16-bit .wav file samples
+        } else if (strcmp(argv[index], "--dither") == 0) {
+            set_dither(true);
+
         //  --midi-help     print format for midi string
         } else if (strcmp(argv[index], "--midi-help") == 0) {
             midi_help();
@@ -397,7 +642,7 @@ int main(int argc, const char * argv[]) {
 
     if (error == SE_NO_ERROR && do_final_play) {
         if (needs_init) {
-            init_sound();
+            if (!counting) init_sound();
             needs_init = false;
         }
 
@@ -407,50 +652,431 @@ int main(int argc, const char * argv[]) {
         if (error == SE_NO_ERROR) error = wait_for_buffers();
     }
 
+    if (error == SE_NO_ERROR && !counting) error = wait_for_streams();
+
+    if (compiling && !counting) {
+        SoundError program_error = end_program();
+        if (error == SE_NO_ERROR) error = program_error;
+    }
+
     if (in_file != NULL) {
         if (in_file != stdin) fclose(in_file);
         in_file = NULL;
     }
 
-    if (out_file != NULL) {
-        error = finish_wave_file(out_file);
-        fclose(out_file);
-        out_file = NULL;
+    if (out_file != NULL && !counting) {
+        SoundError file_error = finish_wave_file(out_file);
+
+        if (out_file == stdout) {
+            if (fflush(out_file) != 0 && file_error == SE_NO_ERROR) file_error = SE_FILE_WRITE_ERROR;
+
+        } else {
+            if (fclose(out_file) != 0 && file_error == SE_NO_ERROR) file_error = SE_FILE_WRITE_ERROR;
+        }
+
+        if (error == SE_NO_ERROR) error = file_error;
+    }
+
+    out_file = NULL;
+
+    return error;
+}
+
+// true if tones written to the .wav file are determined by the options alone, without reading
+// input, so they can be counted before they are written
+bool output_is_countable(int argc, const char *argv[]);
+bool output_is_countable(int argc, const char *argv[])
+{
+    bool has_output = false;
+    bool has_input = false;
+
+    for (int index = 1; index < argc; index++) {
+        if (strcmp(argv[index], "-o") == 0 || strcmp(argv[index], "--wav") == 0) {
+            has_output = true;
+
+        } else if (strcmp(argv[index], "-i") == 0 || strcmp(argv[index], "-I") == 0 ||
+                   strcmp(argv[index], "--play") == 0) {
+            has_input = true;
+        }
+    }
+
+    return has_output && !has_input;
+}
+
+// run options, rendering everything they specify
+SoundError render_command(int argc, const char *argv[], bool initialized);
+SoundError render_command(int argc, const char *argv[], bool initialized)
+{
+    SoundError error = SE_NO_ERROR;
+
+    // a .wav file streamed to a pipe can't be rewound to fill in its header at the end, so count
+    // its samples first when possible
+    if (output_is_countable(argc, argv)) {
+        begin_sample_count();
+        error = run_options(argc, argv, true, initialized);
+        set_wave_sample_count(end_sample_count());
+    }
+
+    if (error == SE_NO_ERROR) error = run_options(argc, argv, false, initialized);
+
+    return error;
+}
+
+// Render cache (--cache DIR): options that render one .wav file, or one sound to be played, from
+// the options alone are rendered once into the cache, and later copied or played from there. An
+// output file named by -o must precede the options that play tones, so that the whole render goes
+// to it. Other options, such as -i, run as they would without --cache.
+#define DEFAULT_CACHE_MBYTES 64
+#define CACHE_KEY_VERSION "mbeep cache 2"
+#define NUMBER_SIZE 32
+
+// options followed by a value (--on by two)
+const char *value_options[] = {
+    "-f", "-t", "-g", "-r", "-b", "-m", "-w", "--paris-wpm", "--codex-wpm", "--farnsworth", "-x", "--wss",
+    "-c", "-i", "--play", "--device", "--rate", "--synth-rate", "--resample", "--stream", "--stop-stream",
+    "--busy", "--daemon", "--window", "--limit", "--burst", "--events", "--on", "--watch", "-o", "--wav",
+    "--format", "--cache", "--cache-size", "--tone-cache", "--compile", "--run", NULL
+};
+
+// options whose values are numbers, put in normal form in cache keys
+const char *number_options[] = {
+    "-f", "-t", "-g", "-r", "-b", "-w", "--paris-wpm", "--codex-wpm", "--farnsworth", "-x", "--wss", "--rate",
+    "--synth-rate", NULL
+};
+
+// options that read input, play more than one sound, depend on time, or render nothing
+const char *uncached_options[] = {
+    "-i", "-I", "--play", "--compile", "--run", "--stream", "--stop-stream", "--daemon", "--events", "--watch",
+    "--fcc", "-e", "--midi-help", "--morse-help", "--version", "-v", "--help", "-h", "--man-page", "--license", NULL
+};
+
+// options that only set up the device, or only apply to .wav files
+const char *device_options[] = { "--device", "--loopback", NULL };
+const char *file_options[] = { "--raw", "--format", "--dither", NULL };
+
+// options that change how tones are rendered, but not what is rendered; left out of cache keys
+const char *unkeyed_options[] = { "--tone-cache", NULL };
+
+bool is_option_in(const char *option, const char *options[]);
+bool is_option_in(const char *option, const char *options[])
+{
+    bool found = false;
+
+    for (int k = 0; options[k] != NULL && !found; k++) {
+        if (strcmp(option, options[k]) == 0) found = true;
+    }
+
+    return found;
+}
+
+// number of values that follow option at index
+int option_values(int argc, const char *argv[], int index);
+int option_values(int argc, const char *argv[], int index)
+{
+    int values = 0;
+
+    if (is_option_in(argv[index], value_options)) values = strcmp(argv[index], "--on") == 0 ? 2 : 1;
+    if (index + values >= argc) values = argc - 1 - index;
+
+    return values;
+}
+
+// true if options render one .wav file, or one sound, determined by the options alone
+bool output_is_cacheable(int argc, const char *argv[]);
+bool output_is_cacheable(int argc, const char *argv[])
+{
+    bool cacheable = true;
+    bool has_tones = false;
+    int outputs = 0;
+
+    for (int index = 1; index < argc && cacheable; index += 1 + option_values(argc, argv, index)) {
+        const char *option = argv[index];
+
+        if (is_option_in(option, uncached_options)) {
+            cacheable = false;
+
+        } else if (strcmp(option, "-o") == 0 || strcmp(option, "--wav") == 0) {
+            outputs++;
+            if (has_tones) cacheable = false;
+
+        } else if (strcmp(option, "-p") == 0 || strcmp(option, "-m") == 0 || strcmp(option, "-c") == 0) {
+            has_tones = true;
+
+        } else if (strcmp(option, "--rate") == 0 && index + 1 < argc && strcmp(argv[index + 1], "native") == 0) {
+            cacheable = false;
+        }
+    }
+
+    if (outputs > 1) cacheable = false;
+#ifdef GPIO
+    // tones are played by toggling a pin, not from samples
+    if (outputs == 0) cacheable = false;
+#endif
+
+    return cacheable;
+}
+
+// true if option (at index) is left out of the render into the cache
+bool is_render_option_left_out(const char *argv[], int index, bool to_device);
+bool is_render_option_left_out(const char *argv[], int index, bool to_device)
+{
+    const char *option = argv[index];
+
+    return strcmp(option, "--cache") == 0 || strcmp(option, "--cache-size") == 0 ||
+           strcmp(option, "-o") == 0 || strcmp(option, "--wav") == 0 ||
+           (to_device && is_option_in(option, file_options));
+}
+
+// append bytes to key
+SoundError add_to_key(char **key, size_t *key_size, const char *bytes, size_t size);
+SoundError add_to_key(char **key, size_t *key_size, const char *bytes, size_t size)
+{
+    SoundError error = SE_NO_ERROR;
+    char *resized = (char *)realloc(*key, *key_size + size);
+
+    if (resized == NULL) {
+        error = SE_OUT_OF_MEMORY;
+
+    } else {
+        memcpy(resized + *key_size, bytes, size);
+        *key = resized;
+        *key_size += size;
+    }
+
+    return error;
+}
+
+// cache key: the options that determine what is rendered, each NUL-terminated, with numbers and
+// Morse code text in normal form ("20" for "20.0", as "-c" is case-insensitive)
+SoundError cache_key(int argc, const char *argv[], bool to_device, char **key, size_t *key_size);
+SoundError cache_key(int argc, const char *argv[], bool to_device, char **key, size_t *key_size)
+{
+    *key = NULL;
+    *key_size = 0;
+
+    SoundError error = add_to_key(key, key_size, CACHE_KEY_VERSION, sizeof(CACHE_KEY_VERSION));
+#ifdef FIXED_POINT
+    if (error == SE_NO_ERROR) error = add_to_key(key, key_size, "FIXED_POINT", sizeof("FIXED_POINT"));
+#endif
+    if (error == SE_NO_ERROR && to_device) error = add_to_key(key, key_size, "device", sizeof("device"));
+
+    for (int index = 1; index < argc && error == SE_NO_ERROR; index++) {
+        const char *option = argv[index];
+        int values = option_values(argc, argv, index);
+
+        if (!is_render_option_left_out(argv, index, to_device) && !is_option_in(option, device_options) &&
+            !is_option_in(option, unkeyed_options)) {
+            error = add_to_key(key, key_size, option, strlen(option) + 1);
+
+            for (int k = 1; k <= values && error == SE_NO_ERROR; k++) {
+                const char *value = argv[index + k];
+                char number[NUMBER_SIZE];
+                char *end;
+                double parsed = strtod(value, &end);
+
+                if (is_option_in(option, number_options) && end != value && *end == '\0') {
+                    snprintf(number, NUMBER_SIZE, "%.17g", parsed);
+                    error = add_to_key(key, key_size, number, strlen(number) + 1);
+
+                } else if (strcmp(option, "-c") == 0) {
+                    size_t start = *key_size;
+
+                    error = add_to_key(key, key_size, value, strlen(value) + 1);
+                    for (size_t n = start; n < *key_size && error == SE_NO_ERROR; n++) {
+                        (*key)[n] = (char)toupper((unsigned char)(*key)[n]);
+                    }
+
+                } else {
+                    error = add_to_key(key, key_size, value, strlen(value) + 1);
+                }
+            }
+        }
+
+        index += values;
+    }
+
+    return error;
+}
+
+// copy cached file at path to out_path, or play it if out_path is NULL (args has room for the
+// options it is played with)
+SoundError use_cached(const char **args, int argc, const char *argv[], const char *path, const char *out_path,
+                      bool initialized);
+SoundError use_cached(const char **args, int argc, const char *argv[], const char *path, const char *out_path,
+                      bool initialized)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (out_path != NULL) {
+        error = copy_cached(path, out_path);
+
+    } else {
+        // play cached file, from a memory mapping
+        int count = 0;
+        args[count++] = argv[0];
+
+        for (int index = 1; index < argc; index++) {
+            int values = option_values(argc, argv, index);
+
+            if ((!initialized && (is_option_in(argv[index], device_options) || strcmp(argv[index], "--rate") == 0)) ||
+                strcmp(argv[index], "--resample") == 0) {
+                for (int k = 0; k <= values; k++) args[count++] = argv[index + k];
+            }
+
+            index += values;
+        }
+
+        args[count++] = "--play";
+        args[count++] = path;
+        error = render_command(count, args, initialized);
+    }
+
+    return error;
+}
+
+// run options through render cache in directory cache_dir, keeping it within cache_size bytes
+SoundError run_cached(int argc, const char *argv[], const char *cache_dir, uint64_t cache_size, bool initialized);
+SoundError run_cached(int argc, const char *argv[], const char *cache_dir, uint64_t cache_size, bool initialized)
+{
+    const char *out_path = NULL;
+    char *key = NULL;
+    size_t key_size = 0;
+    char path[CACHE_PATH_SIZE];
+    char temp_path[CACHE_PATH_SIZE];
+    bool hit = false;
+    int cached_fd = -1;
+
+    for (int index = 1; index < argc; index += 1 + option_values(argc, argv, index)) {
+        if ((strcmp(argv[index], "-o") == 0 || strcmp(argv[index], "--wav") == 0) && index + 1 < argc) {
+            out_path = argv[index + 1];
+        }
+    }
+
+    bool to_device = out_path == NULL;
+    const char **args = (const char **)malloc((argc + 3) * sizeof(const char *));
+    SoundError error = args != NULL ? cache_key(argc, argv, to_device, &key, &key_size) : SE_OUT_OF_MEMORY;
+
+    if (error == SE_NO_ERROR) error = cache_path(cache_dir, key, key_size, path, temp_path);
+    if (error == SE_NO_ERROR) hit = cache_lookup(path);
+
+    if (error == SE_NO_ERROR && hit) {
+        // removed by another process since it was looked up, so render it again
+        cached_fd = open(path, O_RDONLY);
+        hit = cached_fd >= 0;
+    }
+
+    if (error == SE_NO_ERROR && !hit) {
+        // render into temporary file, then add it to cache
+        int count = 0;
+        args[count++] = argv[0];
+        args[count++] = "-o";
+        args[count++] = temp_path;
+
+        for (int index = 1; index < argc; index++) {
+            int values = option_values(argc, argv, index);
+
+            if (!is_render_option_left_out(argv, index, to_device)) {
+                for (int k = 0; k <= values; k++) args[count++] = argv[index + k];
+            }
+
+            index += values;
+        }
+
+        error = render_command(count, args, initialized);
+
+        if (error == SE_NO_ERROR) {
+            cached_fd = open(temp_path, O_RDONLY);
+            if (cached_fd < 0) error = SE_INPUT_FILE_OPEN_ERROR;
+        }
+
+        if (error == SE_NO_ERROR) {
+            error = cache_store(cache_dir, temp_path, path, cache_size);
+
+        } else {
+            unlink(temp_path);
+        }
+
+        // rendering opened the device, as it does without the cache
+        initialized = true;
+    }
+
+    if (error == SE_NO_ERROR) {
+        // used through descriptor held open, so that evicting it (by another process) doesn't matter
+        snprintf(path, CACHE_PATH_SIZE, "/dev/fd/%d", cached_fd);
+        error = use_cached(args, argc, argv, path, out_path, initialized);
+    }
+
+    if (cached_fd >= 0) close(cached_fd);
+
+    free(key);
+    free(args);
+
+    return error;
+}
+
+// run options of command line or daemon request
+SoundError run_command(int argc, const char *argv[], bool initialized);
+SoundError run_command(int argc, const char *argv[], bool initialized)
+{
+    SoundError error = SE_NO_ERROR;
+    const char *cache_dir = NULL;
+    uint64_t cache_size = (uint64_t)DEFAULT_CACHE_MBYTES << 20;
+
+    for (int index = 1; index + 1 < argc; index += 1 + option_values(argc, argv, index)) {
+        if (strcmp(argv[index], "--cache") == 0) {
+            cache_dir = argv[index + 1];
+
+        } else if (strcmp(argv[index], "--cache-size") == 0) {
+            if (!parse_cache_size(argv[index + 1], &cache_size)) error = SE_INVALID_VALUE;
+        }
+    }
+
+    if (error != SE_NO_ERROR) {
+        // reported before anything is played
+
+    } else if (cache_dir != NULL && output_is_cacheable(argc, argv)) {
+        error = run_cached(argc, argv, cache_dir, cache_size, initialized);
+
+    } else {
+        error = render_command(argc, argv, initialized);
+    }
+
+    return error;
+}
+
+// run options sent to daemon (or of an event or watched line), with device already open; settings
+// changed by one request don't carry over to the next
+SoundError run_daemon_request(int argc, const char *argv[])
+{
+    SoundSettings settings;
+
+    get_sound_settings(&settings);
+    SoundError error = run_command(argc, argv, true);
+    set_sound_settings(&settings);
+
+    return error;
+}
+
+int main(int argc, const char * argv[]) {
+    SoundError error = SE_NO_ERROR;
+
+    //  --client  send options to daemon, instead of running them
+    if (argc >= 3 && strcmp(argv[1], "--client") == 0) {
+        SoundError result = SE_NO_ERROR;
+
+        error = send_request(argv[2], argc - 3, argv + 3, &result);
+        if (error == SE_NO_ERROR) error = result;
+
+    } else {
+        error = run_command(argc, argv, false);
     }
 
-    switch (error) {
-        case SE_NO_ERROR:                                                       break;
-        case SE_EXIT:                                                           break;
-        case SE_NO_DEVICE:          printf("Error: SE_NO_DEVICE\n");            break;
-        case SE_NO_CONTEXT:         printf("Error: SE_NO_CONTEXT\n");           break;
-        case SE_INVALID_NAME:       printf("Error: SE_INVALID_NAME\n");         break;
-        case SE_INVALID_ENUM:       printf("Error: SE_INVALID_ENUM\n");         break;
-        case SE_INVALID_VALUE:      printf("Error: SE_INVALID_VALUE\n");        break;
-        case SE_INVALID_OPERATION:  printf("Error: SE_INVALID_OPERATION\n");    break;
-        case SE_OUT_OF_MEMORY:      printf("Error: SE_OUT_OF_MEMORY\n");        break;
-        case SE_INVALID_FREQUENCY:  printf("Error: SE_INVALID_FREQUENCY\n");    break;
-        case SE_INVALID_WPM:        printf("Error: SE_INVALID_WPM\n");          break;
-        case SE_INVALID_BPM:        printf("Error: SE_INVALID_BPM\n");          break;
-        case SE_INVALID_MIDI:       printf("Error: SE_INVALID_MIDI\n");         break;
-        case SE_INVALID_NOTE:       printf("Error: SE_INVALID_NOTE\n");         break;
-        case SE_INVALID_TIME:       printf("Error: SE_INVALID_TIME\n");         break;
-        case SE_INVALID_GAP:        printf("Error: SE_INVALID_GAP\n");          break;
-        case SE_INVALID_OPTION:     printf("Error: SE_INVALID_OPTION\n");       break;
-        case SE_INVALID_REPEATS:    printf("Error: SE_INVALID_REPEATS\n");      break;
-        case SE_FILE_READ_ERROR:            printf("Error: SE_FILE_READ_ERROR\n");          break;
-        case SE_INPUT_FILE_OPEN_ERROR:      printf("Error: SE_INPUT_FILE_OPEN_ERROR\n");    break;
-        case SE_OUTPUT_FILE_OPEN_ERROR:     printf("Error: SE_OUTPUT_FILE_OPEN_ERROR\n");   break;
-        case SE_FILE_ALREADY_OPEN_ERROR:    printf("Error: SE_FILE_ALREADY_OPEN_ERROR\n");  break;
-        case SE_FILE_WRITE_ERROR:           printf("Error: SE_FILE_WRITE_ERROR\n");         break;
-
-        case SE_UNKNOWN:
-        default:
-            printf("Error: unknown\n");
-            break;
-    };
+    // errors go to standard error, so that they don't end up in output piped from -o -
+    if (error != SE_NO_ERROR && error != SE_EXIT) fprintf(stderr, "Error: %s\n", sound_error_text(error));
 
+    print_loopback_statistics(stderr);
     close_sound();
 
-    return 0;
+    return error == SE_NO_ERROR || error == SE_EXIT ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
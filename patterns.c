@@ -38,14 +38,13 @@
 // play tone followed by gap
 SoundError play(double freq, double msec, double gap, int repeats, FILE *out_file)
 {
+    SoundError error = SE_NO_ERROR;
+
     if (freq == DEFAULT) freq = DEFAULT_BEEP_FREQ;
 
-    for (int k = 0; k < repeats; k++) {
-        fill_buffer_or_file(freq, msec, out_file);
-        fill_buffer_or_file(SILENCE, gap, out_file);
-    }
+    error = fill_repeated(freq, msec, gap, repeats, out_file);
 
-    return SE_NO_ERROR;
+    return error;
 }
 
 // play MIDI notes
@@ -185,7 +184,7 @@ SoundError play_midi(double bpm, double gap, const char *text, FILE *out_file)
 
                 } else {
                     error = fill_buffer_or_file(freq, msec - gap, out_file);
-                    if (error == SE_NO_ERROR) fill_buffer_or_file(SILENCE, gap, out_file);
+                    if (error == SE_NO_ERROR) error = fill_buffer_or_file(SILENCE, gap, out_file);
                 }
             }
 
@@ -203,6 +202,7 @@ SoundError play_code(double freq, double dit, bool paris_standard, double farnsw
                      double extra_word_gap,
                      int *fcc_char_count, const char *text, FILE *out_file)
 {
+    SoundError error = SE_NO_ERROR;
     bool was_space = false;
     bool is_space = false;
     bool no_letter_gap = false;
@@ -226,7 +226,7 @@ SoundError play_code(double freq, double dit, bool paris_standard, double farnsw
         gap_dit = dit + extra / GAP_DITS;
     }
 
-    for (int k = 0; k < strlen(text); k++) {
+    for (int k = 0; k < strlen(text) && error == SE_NO_ERROR; k++) {
         unsigned char c = (unsigned char)toupper(text[k]);
         char sequence[16];
 
@@ -235,7 +235,7 @@ SoundError play_code(double freq, double dit, bool paris_standard, double farnsw
         is_space = false;
 
         if (dit_tone_count > 0 && c != '\\') {
-            fill_buffer_or_file(freq, dit_tone_count * char_dit, out_file);
+            if (error == SE_NO_ERROR) error = fill_buffer_or_file(freq, dit_tone_count * char_dit, out_file);
             dit_tone_count = 0;
         }
 
@@ -334,7 +334,7 @@ SoundError play_code(double freq, double dit, bool paris_standard, double farnsw
                 break;
             case '`':
                 // add dit-length gap
-                fill_buffer_or_file(SILENCE, char_dit, out_file);
+                if (error == SE_NO_ERROR) error = fill_buffer_or_file(SILENCE, char_dit, out_file);
                 break;
             case '\\':
                 // add dit-length tone
@@ -359,33 +359,33 @@ SoundError play_code(double freq, double dit, bool paris_standard, double farnsw
 
         for (int i = 0; i < strlen(sequence); i++) {
             if (sequence[i] == '~') {
-                fill_buffer_or_file(SILENCE, 1000.0, out_file);
+                if (error == SE_NO_ERROR) error = fill_buffer_or_file(SILENCE, 1000.0, out_file);
 
             } else if (sequence[i] == '.') {
-                fill_buffer_or_file(freq, char_dit, out_file);
-                fill_buffer_or_file(SILENCE, char_dit, out_file);
+                if (error == SE_NO_ERROR) error = fill_buffer_or_file(freq, char_dit, out_file);
+                if (error == SE_NO_ERROR) error = fill_buffer_or_file(SILENCE, char_dit, out_file);
 
             } else if (sequence[i] == '-') {
-                fill_buffer_or_file(freq, 3 * char_dit, out_file);
-                fill_buffer_or_file(SILENCE, char_dit, out_file);
+                if (error == SE_NO_ERROR) error = fill_buffer_or_file(freq, 3 * char_dit, out_file);
+                if (error == SE_NO_ERROR) error = fill_buffer_or_file(SILENCE, char_dit, out_file);
             }
         }
 
         if (!no_letter_gap && strlen(sequence) > 0) {
-            fill_buffer_or_file(SILENCE, 3 * gap_dit - char_dit, out_file);
+            if (error == SE_NO_ERROR) error = fill_buffer_or_file(SILENCE, 3 * gap_dit - char_dit, out_file);
         }
 
         if (is_space && !was_space) {
-            fill_buffer_or_file(SILENCE, 4 * gap_dit + extra_word_gap, out_file);
+            if (error == SE_NO_ERROR) error = fill_buffer_or_file(SILENCE, 4 * gap_dit + extra_word_gap, out_file);
         }
 
         was_space = is_space;
     }
 
     if (dit_tone_count > 0) {
-        fill_buffer_or_file(freq, dit_tone_count * char_dit, out_file);
+        if (error == SE_NO_ERROR) error = fill_buffer_or_file(freq, dit_tone_count * char_dit, out_file);
         dit_tone_count = 0;
     }
 
-    return SE_NO_ERROR;
+    return error;
 }
@@ -0,0 +1,226 @@
+//
+// program.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// for madvise()
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "program.h"
+
+#define PROGRAM_MAGIC "MBTP"
+#define PROGRAM_BYTE_ORDER 0x01020304U
+#define PROGRAM_VERSION 1
+
+struct ProgramHeader {
+    char magic[4];
+    uint32_t byte_order;
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+};
+typedef struct ProgramHeader ProgramHeader;
+
+enum {
+    PR_TONE = 0,        // tone or gap (fill_buffer_or_file())
+    PR_REPEATED         // tone followed by gap, repeated (fill_repeated())
+};
+
+struct ProgramRecord {
+    double freq;
+    double msec;
+    double gap;
+    int32_t repeats;
+    uint32_t kind;
+};
+typedef struct ProgramRecord ProgramRecord;
+
+FILE *program_file = NULL;
+uint64_t program_records = 0;
+bool program_write_failed = false;
+
+SoundError record_tone(double freq, double msec, double gap, int repeats, bool repeated);
+SoundError record_tone(double freq, double msec, double gap, int repeats, bool repeated)
+{
+    ProgramRecord record;
+
+    memset(&record, 0, sizeof(record));
+    record.freq = freq;
+    record.msec = msec;
+    record.gap = gap;
+    record.repeats = repeats;
+    record.kind = repeated ? PR_REPEATED : PR_TONE;
+
+    if (fwrite(&record, sizeof(record), 1, program_file) != 1) program_write_failed = true;
+    program_records++;
+
+    return program_write_failed ? SE_FILE_WRITE_ERROR : SE_NO_ERROR;
+}
+
+SoundError write_program_header(void);
+SoundError write_program_header(void)
+{
+    ProgramHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROGRAM_MAGIC, sizeof(header.magic));
+    header.byte_order = PROGRAM_BYTE_ORDER;
+    header.version = PROGRAM_VERSION;
+    header.record_size = sizeof(ProgramRecord);
+    header.record_count = program_records;
+
+    bool ok = fseeko(program_file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, program_file) == 1;
+
+    return ok ? SE_NO_ERROR : SE_FILE_WRITE_ERROR;
+}
+
+// record tones played from now on into tone program at path, instead of playing them
+SoundError begin_program(const char *path)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (program_file != NULL) error = SE_FILE_ALREADY_OPEN_ERROR;
+
+    if (error == SE_NO_ERROR) {
+        program_file = fopen(path, "wb");
+        if (program_file == NULL) error = SE_OUTPUT_FILE_OPEN_ERROR;
+    }
+
+    if (error == SE_NO_ERROR) {
+        program_records = 0;
+        program_write_failed = false;
+
+        // header is written again with record count at end
+        error = write_program_header();
+    }
+
+    if (error == SE_NO_ERROR) {
+        set_tone_recorder(record_tone);
+
+    } else if (program_file != NULL) {
+        fclose(program_file);
+        program_file = NULL;
+    }
+
+    return error;
+}
+
+// finish tone program, and play tones again
+SoundError end_program(void)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (program_file != NULL) {
+        set_tone_recorder(NULL);
+
+        if (program_write_failed) error = SE_FILE_WRITE_ERROR;
+        if (error == SE_NO_ERROR) error = write_program_header();
+        if (fclose(program_file) != 0 && error == SE_NO_ERROR) error = SE_FILE_WRITE_ERROR;
+        program_file = NULL;
+    }
+
+    return error;
+}
+
+// true if record could have been written by record_tone() for options that mbeep accepts
+bool is_valid_record(const ProgramRecord *record);
+bool is_valid_record(const ProgramRecord *record)
+{
+    bool valid = record->kind == PR_TONE || record->kind == PR_REPEATED;
+
+    if (valid) valid = isfinite(record->msec) && record->msec >= 0.0 && isfinite(record->gap) && record->gap >= 0.0;
+    if (valid) valid = record->freq == SILENCE || (record->freq >= 20.0 && record->freq <= 20000.0);
+    if (valid) valid = record->repeats >= 0;
+
+    return valid;
+}
+
+// play tones of tone program at path, or write them to out_file
+SoundError run_program(const char *path, FILE *out_file)
+{
+    SoundError error = SE_NO_ERROR;
+    struct stat status;
+    void *map = MAP_FAILED;
+    size_t map_size = 0;
+    const ProgramHeader *header = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &status) != 0) error = SE_INPUT_FILE_OPEN_ERROR;
+
+    if (error == SE_NO_ERROR) {
+        map_size = (size_t)status.st_size;
+        if (map_size < sizeof(ProgramHeader)) error = SE_INVALID_FILE_FORMAT;
+    }
+
+    if (error == SE_NO_ERROR) {
+        map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) error = SE_FILE_READ_ERROR;
+    }
+
+    if (error == SE_NO_ERROR) {
+        header = (const ProgramHeader *)map;
+
+        if (memcmp(header->magic, PROGRAM_MAGIC, sizeof(header->magic)) != 0 ||
+            header->byte_order != PROGRAM_BYTE_ORDER || header->version != PROGRAM_VERSION ||
+            header->record_size != sizeof(ProgramRecord) ||
+            header->record_count > (map_size - sizeof(ProgramHeader)) / sizeof(ProgramRecord)) {
+            error = SE_INVALID_FILE_FORMAT;
+        }
+    }
+
+    if (error == SE_NO_ERROR) {
+        const ProgramRecord *records = (const ProgramRecord *)((const char *)map + sizeof(ProgramHeader));
+
+        // check every record before playing any of them
+        madvise(map, map_size, MADV_SEQUENTIAL);
+
+        for (uint64_t k = 0; k < header->record_count && error == SE_NO_ERROR; k++) {
+            if (!is_valid_record(&records[k])) error = SE_INVALID_FILE_FORMAT;
+        }
+
+        for (uint64_t k = 0; k < header->record_count && error == SE_NO_ERROR; k++) {
+            const ProgramRecord *record = &records[k];
+
+            if (record->kind == PR_REPEATED) {
+                error = fill_repeated(record->freq, record->msec, record->gap, record->repeats, out_file);
+
+            } else {
+                error = fill_buffer_or_file(record->freq, record->msec, out_file);
+            }
+        }
+    }
+
+    if (map != MAP_FAILED) munmap(map, map_size);
+    if (fd >= 0) close(fd);
+
+    return error;
+}
@@ -0,0 +1,303 @@
+//
+// resample.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "resample.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Rates are reduced by their greatest common divisor, so that output k is at input position
+// k * in_step / out_step. If out_step is at most MAX_PHASES, there is a filter phase for every
+// output position; otherwise the position is rounded down to one of MAX_PHASES phases.
+#define MAX_PHASES 512
+#define MAX_TAPS 1024
+
+// input kept beyond the filter length, so that history is moved once per block rather than once
+// per sample
+#define HISTORY_BLOCK 4096
+
+struct Resampler {
+    unsigned int in_step;       // rates divided by their GCD
+    unsigned int out_step;
+    size_t taps;                // taps per phase, a multiple of 4
+    size_t phases;
+    float *filter;              // phases * taps coefficients
+    float *history;             // input, preceded by taps / 2 - 1 zeros when starting
+    size_t history_size;
+    size_t history_count;
+    size_t index;               // history index of first tap for next output
+    unsigned int fraction;      // position of next output after that input, in 1 / out_step units
+    uint64_t discarded;         // history samples dropped since starting
+    uint64_t input_count;       // samples pushed since starting
+};
+
+// taps (at the lower rate), Kaiser window beta, and cutoff as fraction of lower Nyquist frequency,
+// for each quality
+typedef struct {
+    size_t taps;
+    double beta;
+    double rolloff;
+} FilterDesign;
+
+const FilterDesign filter_designs[] = {
+    [RQ_FAST] = { 8, 5.0, 0.80 },
+    [RQ_MEDIUM] = { 24, 7.0, 0.90 },
+    [RQ_BEST] = { 64, 9.0, 0.95 }
+};
+
+unsigned int greatest_common_divisor(unsigned int a, unsigned int b);
+unsigned int greatest_common_divisor(unsigned int a, unsigned int b)
+{
+    while (b != 0) {
+        unsigned int r = a % b;
+        a = b;
+        b = r;
+    }
+
+    return a;
+}
+
+// modified Bessel function of the first kind, order 0
+double bessel_i0(double x);
+double bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+
+    for (int k = 1; k < 50 && term > 1e-12 * sum; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+void design_filter(Resampler *resampler, unsigned int in_rate, unsigned int out_rate, const FilterDesign *design);
+void design_filter(Resampler *resampler, unsigned int in_rate, unsigned int out_rate, const FilterDesign *design)
+{
+    size_t taps = resampler->taps;
+    double half = taps / 2;
+    double cutoff = 0.5 * design->rolloff * (out_rate < in_rate ? (double)out_rate / in_rate : 1.0);
+    double window_scale = 1.0 / bessel_i0(design->beta);
+
+    for (size_t phase = 0; phase < resampler->phases; phase++) {
+        float *h = resampler->filter + phase * taps;
+        double offset = (double)phase / resampler->phases;
+        double sum = 0.0;
+
+        for (size_t k = 0; k < taps; k++) {
+            // distance from output position to input sample
+            double distance = k - (half - 1.0) - offset;
+            double x = distance / half;
+            double window = x * x < 1.0 ? bessel_i0(design->beta * sqrt(1.0 - x * x)) * window_scale : 0.0;
+            double theta = 2.0 * M_PI * cutoff * distance;
+            double sinc = theta == 0.0 ? 1.0 : sin(theta) / theta;
+
+            h[k] = (float)(sinc * window);
+            sum += h[k];
+        }
+
+        // unity gain at DC for every phase
+        for (size_t k = 0; k < taps; k++) h[k] = (float)(h[k] / sum);
+    }
+}
+
+void reset_resampler(Resampler *resampler);
+void reset_resampler(Resampler *resampler)
+{
+    resampler->history_count = resampler->taps / 2 - 1;
+    memset(resampler->history, 0, resampler->history_count * sizeof(float));
+    resampler->index = 0;
+    resampler->fraction = 0;
+    resampler->discarded = 0;
+    resampler->input_count = 0;
+}
+
+// returns NULL if out of memory
+Resampler *new_resampler(unsigned int in_rate, unsigned int out_rate, ResampleQuality quality)
+{
+    Resampler *resampler = (Resampler *)calloc(1, sizeof(Resampler));
+    const FilterDesign *design = &filter_designs[quality >= RQ_FAST && quality <= RQ_BEST ? quality : RQ_MEDIUM];
+
+    if (resampler != NULL) {
+        unsigned int divisor = greatest_common_divisor(in_rate, out_rate);
+        resampler->in_step = in_rate / divisor;
+        resampler->out_step = out_rate / divisor;
+        // when reducing the rate, the filter is stretched to cover the same number of output samples
+        size_t taps = design->taps;
+        if (in_rate > out_rate) taps = (size_t)ceil((double)taps * in_rate / out_rate);
+        taps = (taps + 3) & ~(size_t)3;
+        resampler->taps = taps < MAX_TAPS ? taps : MAX_TAPS;
+        resampler->phases = resampler->out_step <= MAX_PHASES ? resampler->out_step : MAX_PHASES;
+        resampler->history_size = resampler->taps + HISTORY_BLOCK;
+        resampler->filter = (float *)malloc(resampler->phases * resampler->taps * sizeof(float));
+        resampler->history = (float *)malloc(resampler->history_size * sizeof(float));
+
+        if (resampler->filter == NULL || resampler->history == NULL) {
+            delete_resampler(resampler);
+            resampler = NULL;
+        }
+    }
+
+    if (resampler != NULL) {
+        design_filter(resampler, in_rate, out_rate, design);
+        reset_resampler(resampler);
+    }
+
+    return resampler;
+}
+
+void delete_resampler(Resampler *resampler)
+{
+    if (resampler != NULL) {
+        free(resampler->filter);
+        free(resampler->history);
+        free(resampler);
+    }
+}
+
+// most samples written by resample() for count input samples plus the following resample_flush()
+size_t resample_capacity(const Resampler *resampler, size_t count)
+{
+    return (size_t)((uint64_t)(count + resampler->taps) * resampler->out_step / resampler->in_step) + 2;
+}
+
+// number of samples produced for count input samples, including flush
+uint64_t resampled_count(uint64_t count, unsigned int in_rate, unsigned int out_rate)
+{
+    unsigned int divisor = greatest_common_divisor(in_rate, out_rate);
+    uint64_t in_step = in_rate / divisor;
+    uint64_t out_step = out_rate / divisor;
+
+    return (count * out_step + in_step - 1) / in_step;
+}
+
+static inline float dot_product(const float *a, const float *b, size_t count)
+{
+    size_t k = 0;
+    float result = 0.0f;
+
+#if defined(__SSE2__)
+    __m128 sum = _mm_setzero_ps();
+
+    for (; k + 4 <= count; k += 4) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+
+    __m128 shuffled = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+    sum = _mm_add_ps(sum, shuffled);
+    sum = _mm_add_ss(sum, _mm_movehl_ps(shuffled, sum));
+    result = _mm_cvtss_f32(sum);
+
+#elif defined(__ARM_NEON)
+    float32x4_t sum = vdupq_n_f32(0.0f);
+
+    for (; k + 4 <= count; k += 4) sum = vmlaq_f32(sum, vld1q_f32(a + k), vld1q_f32(b + k));
+
+    float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    result = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+
+    for (; k < count; k++) result += a[k] * b[k];
+
+    return result;
+}
+
+// write output samples for positions before limit (input index) that have all of their input
+size_t produce_samples(Resampler *resampler, float *out, uint64_t limit);
+size_t produce_samples(Resampler *resampler, float *out, uint64_t limit)
+{
+    size_t count = 0;
+    size_t taps = resampler->taps;
+
+    while (resampler->index + taps <= resampler->history_count &&
+           resampler->index + resampler->discarded < limit) {
+        size_t phase = resampler->phases == resampler->out_step ? resampler->fraction :
+            (size_t)((uint64_t)resampler->fraction * resampler->phases / resampler->out_step);
+
+        out[count++] = dot_product(resampler->history + resampler->index, resampler->filter + phase * taps, taps);
+
+        resampler->fraction += resampler->in_step;
+        resampler->index += resampler->fraction / resampler->out_step;
+        resampler->fraction %= resampler->out_step;
+    }
+
+    // drop input that no later output needs
+    size_t used = resampler->index < resampler->history_count ? resampler->index : resampler->history_count;
+    memmove(resampler->history, resampler->history + used, (resampler->history_count - used) * sizeof(float));
+    resampler->history_count -= used;
+    resampler->index -= used;
+    resampler->discarded += used;
+
+    return count;
+}
+
+// resample count input samples; returns number of samples written to out, which must have room for
+// resample_capacity(resampler, count) samples
+size_t resample(Resampler *resampler, const float *in, size_t count, float *out)
+{
+    size_t produced = 0;
+
+    while (count > 0) {
+        size_t space = resampler->history_size - resampler->history_count;
+        size_t block = count < space ? count : space;
+
+        memcpy(resampler->history + resampler->history_count, in, block * sizeof(float));
+        resampler->history_count += block;
+        resampler->input_count += block;
+        in += block;
+        count -= block;
+
+        produced += produce_samples(resampler, out + produced, UINT64_MAX);
+    }
+
+    return produced;
+}
+
+// write output samples for the end of the input, as if followed by silence, and start over
+size_t resample_flush(Resampler *resampler, float *out)
+{
+    size_t padding = resampler->taps;
+
+    memset(resampler->history + resampler->history_count, 0, padding * sizeof(float));
+    resampler->history_count += padding;
+
+    size_t produced = produce_samples(resampler, out, resampler->input_count);
+
+    reset_resampler(resampler);
+
+    return produced;
+}
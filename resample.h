@@ -0,0 +1,50 @@
+//
+// resample.h
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef resample_h
+#define resample_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sound.h"
+
+// Polyphase resampler for mono float samples. Each output sample is the dot product of the input
+// around its position with one phase of a Kaiser-windowed sinc filter; the number of taps depends
+// on the quality. Input is pushed in blocks of any size; output for the end of the input is
+// produced by resample_flush(), after which the resampler starts over.
+
+typedef struct Resampler Resampler;
+
+Resampler *new_resampler(unsigned int in_rate, unsigned int out_rate, ResampleQuality quality);
+void delete_resampler(Resampler *resampler);
+size_t resample_capacity(const Resampler *resampler, size_t count);
+size_t resample(Resampler *resampler, const float *in, size_t count, float *out);
+size_t resample_flush(Resampler *resampler, float *out);
+uint64_t resampled_count(uint64_t count, unsigned int in_rate, unsigned int out_rate);
+
+#endif /* resample_h */
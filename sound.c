@@ -24,11 +24,18 @@
 // WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
+// for mmap(), ftruncate() and fseeko(), and for ALSA
+#define _DEFAULT_SOURCE
+
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #ifdef __APPLE__
     // first deprecated in macOS 10.15 - OpenAL is deprecated in favor of AVAudioEngine
@@ -40,25 +47,399 @@
 #else
     #ifdef GPIO
         #include "tiny_gpio.h"
+    #elif defined(ALSA)
+        #include <errno.h>
+        #include <alsa/asoundlib.h>
     #else
         #include <AL/al.h>
         #include <AL/alc.h>
+        #include <AL/alext.h>
     #endif
 
     #define M_PI 3.14159265358979323846
 #endif
 
+#include "convert.h"
+#include "resample.h"
 #include "sound.h"
+#include "tonecache.h"
+#include "writer.h"
 
 #define SAMPLES_PER_SECOND 44100
-#define BUFFER_SIZE (1 * SAMPLES_PER_SECOND)
+#define BUFFER_SECONDS 1
 #define RAMP_MSEC 20.0
 
+// rate used for synthesis and .wav output; set by set_sample_rate(), or by the device if using
+// its native rate
+unsigned int sample_rate = SAMPLES_PER_SECOND;
+bool use_native_rate = false;
+bool rate_requested = false;
+
+// if not 0, tones are synthesized at this rate and resampled to sample_rate; set by set_synth_rate()
+unsigned int synth_rate = 0;
+Resampler *tone_resampler = NULL;
+float *resampled_tone = NULL;
+FILE *tone_file = NULL;
+
+// quality of resampling of tones, and of .wav files played at other rates (or RQ_DEVICE to leave
+// files to the device)
+ResampleQuality resample_quality = RQ_MEDIUM;
+
+// name of output device, or NULL for default device
+const char *device_name = NULL;
+
+// format of .wav file samples; formats other than undithered 16-bit are generated from
+// floating-point samples, with full scale (1.0) corresponding to 32768
+SampleFormat output_format = SF_PCM16;
+bool use_dither = false;
+#define FLOAT_AMPLITUDE (32767.0 / 32768.0)
+
+// .wav header is written before the first samples, once the rate is settled. A regular file gets a
+// placeholder that finish_wave_file() fills in; a pipe or other stream that can't be rewound gets
+// exact sizes if the sample count was given by set_wave_sample_count(), otherwise the "unknown
+// size" value that read_wav() recognizes. Raw output has no header. Files whose sizes don't fit
+// in 32 bits are written as RF64 (EBU Tech 3306), with 64-bit sizes in a ds64 chunk; if the size
+// isn't known in advance, a JUNK chunk reserves space for the ds64 chunk.
+#define UNKNOWN_RIFF_SIZE 2147483684U
+bool raw_output = false;
+bool wave_seekable = true;
+bool wave_header_pending = false;
+size_t wave_header_size = 0;
+uint64_t wave_data_size = 0;
+uint64_t wave_sample_count = 0;
+
+// IMA ADPCM block being filled; blocks hold up to 2 * (2048 - 4) + 1 samples (at 96 kHz)
+#define MAX_ADPCM_BLOCK_SAMPLES 4089
+int16_t adpcm_block[MAX_ADPCM_BLOCK_SAMPLES];
+size_t adpcm_fill = 0;
+int adpcm_index = 0;
+
+// regular file of known size is mapped into memory, and samples are rendered in place
+uint8_t *wave_map = NULL;
+size_t wave_map_size = 0;
+bool wave_count_known = false;
+uint64_t wave_count = 0;
+unsigned int wave_count_rate = 0;
+
+// while counting, samples that would be written to a .wav file are counted instead of written,
+// and nothing is played
+bool counting_samples = false;
+uint64_t counted_samples = 0;
+uint64_t counted_tone_samples = 0;     // synthesized since the last silence, to be resampled
+
+void write_data(short *data_ptr, double freq, size_t ramp_count, size_t total_count,
+                size_t start_index, size_t sample_count);
+void write_float_data(float *data_ptr, double freq, size_t ramp_count, size_t total_count,
+                      size_t start_index, size_t sample_count);
+unsigned int tone_rate(void);
+SoundError fill_resampled(double freq, double msec, FILE *file);
+SoundError flush_resampled(FILE *file);
+SoundError check_preemption(void);
+
+// stream that tones are played on (see select_stream())
+int current_stream = 0;
+
 #ifdef GPIO
-#define __USE_POSIX199309
-#define __USE_XOPEN2K
 #include <time.h>
 
+#elif defined(ALSA)
+// Native ALSA output: samples are rendered straight into the device's ring buffer via
+// snd_pcm_mmap_begin/commit, using the device's native rate and period size, without OpenAL's
+// mixing thread and resampler in between. Tones are synthesized at sample_rate all the same (so
+// that .wav output doesn't depend on the device), and if the device doesn't support it, they are
+// resampled here to its rate (see alsa_play()); only --rate native makes sample_rate the device's.
+#define ALSA_DEFAULT_DEVICE "default"
+#define ALSA_PERIOD_USEC 10000
+#define ALSA_PERIODS 4
+#define ALSA_CONVERT_FRAMES 1024
+
+snd_pcm_t *pcm = NULL;
+unsigned int pcm_rate = 0;          // device's rate
+unsigned int pcm_input_rate = 0;    // rate of samples given to alsa_play()
+Resampler *pcm_resampler = NULL;    // from pcm_input_rate to pcm_rate, if they differ
+float *pcm_input = NULL;
+float *pcm_output = NULL;
+short *pcm_converted = NULL;
+unsigned int pcm_channels = 1;
+snd_pcm_uframes_t period_size = 0;
+snd_pcm_uframes_t ring_size = 0;
+short *data = NULL;
+
+SoundError alsa_to_se_error(int result);
+SoundError alsa_to_se_error(int result)
+{
+    switch (result) {
+        case -ENOENT:
+        case -ENODEV:
+        case -EBUSY:        return(SE_NO_DEVICE);
+        case -EINVAL:       return(SE_INVALID_VALUE);
+        case -ENOMEM:       return(SE_OUT_OF_MEMORY);
+        case -EPIPE:
+        case -ESTRPIPE:
+        case -EBADFD:       return(SE_INVALID_OPERATION);
+        default:            return(result < 0 ? SE_UNKNOWN : SE_NO_ERROR);
+    }
+}
+
+// negotiate hardware and software parameters; on return, *rate holds the rate actually used
+SoundError alsa_configure(unsigned int *rate, bool resample);
+SoundError alsa_configure(unsigned int *rate, bool resample)
+{
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_sw_params_t *sw_params;
+    unsigned int period_usec = ALSA_PERIOD_USEC;
+    unsigned int periods = ALSA_PERIODS;
+    int result;
+
+    snd_pcm_hw_params_alloca(&hw_params);
+    snd_pcm_sw_params_alloca(&sw_params);
+
+    result = snd_pcm_hw_params_any(pcm, hw_params);
+
+    // unless asked to, don't let the plug layer resample; use a rate the device supports natively
+    if (result >= 0) result = snd_pcm_hw_params_set_rate_resample(pcm, hw_params, resample ? 1 : 0);
+    if (result >= 0) result = snd_pcm_hw_params_set_access(pcm, hw_params,
+                                                           SND_PCM_ACCESS_MMAP_INTERLEAVED);
+    if (result >= 0) result = snd_pcm_hw_params_set_format(pcm, hw_params, SND_PCM_FORMAT_S16);
+    if (result >= 0) {
+        pcm_channels = 1;
+        result = snd_pcm_hw_params_set_channels_near(pcm, hw_params, &pcm_channels);
+    }
+    if (result >= 0) result = snd_pcm_hw_params_set_rate_near(pcm, hw_params, rate, NULL);
+    if (result >= 0) result = snd_pcm_hw_params_set_period_time_near(pcm, hw_params, &period_usec, NULL);
+    if (result >= 0) result = snd_pcm_hw_params_set_periods_near(pcm, hw_params, &periods, NULL);
+    if (result >= 0) result = snd_pcm_hw_params(pcm, hw_params);
+    if (result >= 0) result = snd_pcm_hw_params_get_period_size(hw_params, &period_size, NULL);
+    if (result >= 0) result = snd_pcm_hw_params_get_buffer_size(hw_params, &ring_size);
+
+    // device is started explicitly when ring is full (see alsa_wait) or by play_buffers()
+    if (result >= 0) result = snd_pcm_sw_params_current(pcm, sw_params);
+    if (result >= 0) result = snd_pcm_sw_params_set_start_threshold(pcm, sw_params, ring_size);
+    if (result >= 0) result = snd_pcm_sw_params_set_avail_min(pcm, sw_params, period_size);
+    if (result >= 0) result = snd_pcm_sw_params(pcm, sw_params);
+
+    if (result >= 0) {
+        pcm_rate = *rate;
+
+        // scratch buffer, used only when device does not accept mono
+        free(data);
+        data = (short *)calloc(period_size, sizeof(short));
+        if (data == NULL) result = -ENOMEM;
+    }
+
+#if DEBUG
+    fprintf(stderr, "alsa_configure: %u Hz, %u channels, period %lu, ring %lu\n", pcm_rate, pcm_channels,
+            (unsigned long)period_size, (unsigned long)ring_size);
+#endif
+
+    return alsa_to_se_error(result);
+}
+
+// wait until at least one period of the ring buffer is free, starting the device if the ring
+// buffer is full
+SoundError alsa_wait(snd_pcm_uframes_t *available);
+SoundError alsa_wait(snd_pcm_uframes_t *available)
+{
+    SoundError error = SE_NO_ERROR;
+    int result = 0;
+    snd_pcm_sframes_t avail = 0;
+
+    while (result >= 0 && error == SE_NO_ERROR && avail < (snd_pcm_sframes_t)period_size) {
+        avail = snd_pcm_avail_update(pcm);
+
+        if (avail < 0) {
+            // underrun or suspend
+            result = snd_pcm_recover(pcm, (int)avail, 1);
+            avail = 0;
+
+        } else if (avail < (snd_pcm_sframes_t)period_size) {
+            if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED) result = snd_pcm_start(pcm);
+            if (result >= 0) result = snd_pcm_wait(pcm, -1);
+            if (result < 0) result = snd_pcm_recover(pcm, result, 1);
+            if (result >= 0) error = check_preemption();
+        }
+    }
+
+    *available = avail > 0 ? (snd_pcm_uframes_t)avail : 0;
+
+    return error == SE_NO_ERROR ? alsa_to_se_error(result) : error;
+}
+
+// write count samples into the device ring buffer: copied from source, or if source is NULL,
+// rendered in place (starting at sample index of a tone of total samples)
+SoundError alsa_write(const short *source, double freq, size_t ramp, size_t total, size_t index,
+                      size_t count);
+SoundError alsa_write(const short *source, double freq, size_t ramp, size_t total, size_t index,
+                      size_t count)
+{
+    SoundError error = check_preemption();
+
+    while (count > 0 && error == SE_NO_ERROR) {
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t offset = 0;
+        snd_pcm_uframes_t frames = 0;
+
+        error = alsa_wait(&frames);
+
+        if (error == SE_NO_ERROR) {
+            if (frames > count) frames = count;
+            if (pcm_channels > 1 && frames > period_size) frames = period_size;
+
+            error = alsa_to_se_error(snd_pcm_mmap_begin(pcm, &areas, &offset, &frames));
+        }
+
+        if (error == SE_NO_ERROR) {
+            short *ring = (short *)((char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8);
+
+            if (pcm_channels == 1) {
+                if (source != NULL) {
+                    memcpy(ring, source, frames * sizeof(short));
+
+                } else {
+                    write_data(ring, freq, ramp, total, index, frames);
+                }
+
+            } else {
+                const short *mono = source;
+
+                if (mono == NULL) {
+                    write_data(data, freq, ramp, total, index, frames);
+                    mono = data;
+                }
+
+                for (snd_pcm_uframes_t k = 0; k < frames; k++) {
+                    for (unsigned int channel = 0; channel < pcm_channels; channel++) {
+                        *ring++ = mono[k];
+                    }
+                }
+            }
+
+            // only what was committed is done; after recovering, the rest is written again
+            snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, offset, frames);
+            snd_pcm_uframes_t done = committed > 0 ? (snd_pcm_uframes_t)committed : 0;
+
+            if (done != frames) {
+                error = alsa_to_se_error(snd_pcm_recover(pcm, committed < 0 ? (int)committed : -EPIPE, 1));
+            }
+
+#if DEBUG
+            fprintf(stderr, "alsa_write %lu of %lu samples at %lu\n", (unsigned long)done, (unsigned long)frames,
+                    (unsigned long)offset);
+#endif
+
+            if (source != NULL) source += done;
+            index += done;
+            count -= done;
+        }
+    }
+
+    return error;
+}
+
+// samples given to alsa_play() are at rate; they are resampled if the device's rate differs
+SoundError alsa_set_input_rate(unsigned int rate);
+SoundError alsa_set_input_rate(unsigned int rate)
+{
+    SoundError error = SE_NO_ERROR;
+
+    delete_resampler(pcm_resampler);
+    pcm_resampler = NULL;
+    free(pcm_input);
+    free(pcm_output);
+    free(pcm_converted);
+    pcm_input = NULL;
+    pcm_output = NULL;
+    pcm_converted = NULL;
+
+    pcm_input_rate = rate;
+
+    if (rate != pcm_rate) {
+        pcm_resampler = new_resampler(rate, pcm_rate, resample_quality);
+
+        if (pcm_resampler != NULL) {
+            size_t capacity = resample_capacity(pcm_resampler, ALSA_CONVERT_FRAMES);
+
+            pcm_input = (float *)malloc(ALSA_CONVERT_FRAMES * sizeof(float));
+            pcm_output = (float *)malloc(capacity * sizeof(float));
+            pcm_converted = (short *)malloc(capacity * sizeof(short));
+        }
+
+        if (pcm_resampler == NULL || pcm_input == NULL || pcm_output == NULL || pcm_converted == NULL) {
+            error = SE_OUT_OF_MEMORY;
+        }
+    }
+
+    return error;
+}
+
+// play count samples at pcm_input_rate: copied from source, or if source is NULL, rendered
+// (starting at sample index of a tone of total samples); resampled to the device's rate if need be
+SoundError alsa_play(const short *source, double freq, size_t ramp, size_t total, size_t index,
+                     size_t count);
+SoundError alsa_play(const short *source, double freq, size_t ramp, size_t total, size_t index,
+                     size_t count)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (pcm_resampler == NULL) return alsa_write(source, freq, ramp, total, index, count);
+
+    while (count > 0 && error == SE_NO_ERROR) {
+        size_t block = count < ALSA_CONVERT_FRAMES ? count : ALSA_CONVERT_FRAMES;
+
+        if (source == NULL) {
+            write_data(pcm_converted, freq, ramp, total, index, block);
+            frames_to_float((const uint8_t *)pcm_converted, pcm_input, block, 1, 16, false);
+
+        } else {
+            frames_to_float((const uint8_t *)source, pcm_input, block, 1, 16, false);
+            source += block;
+        }
+
+        size_t produced = resample(pcm_resampler, pcm_input, block, pcm_output);
+        float_to_int16(pcm_output, pcm_converted, produced, false);
+        error = alsa_write(pcm_converted, 0.0, 0, 0, 0, produced);
+
+        index += block;
+        count -= block;
+    }
+
+    return error;
+}
+
+// write what the resampler holds of the samples played
+SoundError alsa_flush(void);
+SoundError alsa_flush(void)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (pcm_resampler != NULL) {
+        size_t produced = resample_flush(pcm_resampler, pcm_output);
+        float_to_int16(pcm_output, pcm_converted, produced, false);
+        error = alsa_write(pcm_converted, 0.0, 0, 0, 0, produced);
+    }
+
+    return error;
+}
+
+// play samples at rate from now on, after playing anything already written: with resample, the
+// plug layer converts them to a rate the device supports; otherwise the device's nearest rate is
+// used, and they are resampled here if it differs
+SoundError alsa_set_rate(unsigned int rate, bool resample);
+SoundError alsa_set_rate(unsigned int rate, bool resample)
+{
+    SoundError error = SE_NO_ERROR;
+    unsigned int device_rate = rate;
+
+    if (rate != pcm_input_rate) {
+        error = wait_for_buffers();
+        if (error == SE_NO_ERROR) error = alsa_to_se_error(snd_pcm_hw_free(pcm));
+        if (error == SE_NO_ERROR) error = alsa_configure(&device_rate, resample);
+        if (error == SE_NO_ERROR) error = alsa_set_input_rate(rate);
+    }
+
+    return error;
+}
+
 #else
 bool init_OK = false;
 ALCdevice *device = NULL;
@@ -67,6 +448,7 @@ ALCcontext *context = NULL;
 #define NUM_BUFFERS 3
 ALuint buffers[NUM_BUFFERS];
 ALshort *data = NULL;
+size_t buffer_size = 0;
 bool buffer_queued[NUM_BUFFERS];
 int current_buffer = 0;
 size_t data_offset = 0;
@@ -75,6 +457,11 @@ bool buffers_OK = false;
 ALuint source;
 bool source_OK = false;
 
+SoundError pump_streams(bool drain);
+void set_streams_gain(ALfloat gain);
+void stop_streams(void);
+void close_streams(void);
+
 SoundError al_to_se_error(ALenum al_error);
 SoundError al_to_se_error(ALenum al_error)
 {
@@ -88,280 +475,1734 @@ SoundError al_to_se_error(ALenum al_error)
         default:                    return(SE_UNKNOWN);
     }
 }
-#endif
 
-void write_data(short *data_ptr, double freq, size_t ramp_count, size_t total_count,
-                size_t start_index, size_t sample_count);
+#ifdef ALC_SOFT_loopback
+// Loopback device (OpenAL Soft ALC_SOFT_loopback extension): nothing is sent to a sound card.
+// Device output is rendered by us, in accelerated time, whenever we would otherwise wait for the
+// device, so that the live playback path can be measured without audio hardware.
+#include <sys/time.h>
+#include <time.h>
 
-SoundError init_sound(void)
+#define LOOPBACK_FRAMES 128
+
+bool use_loopback = false;
+LPALCRENDERSAMPLESSOFT render_samples = NULL;
+ALshort loopback_output[LOOPBACK_FRAMES];
+
+struct LoopbackStatistics {
+    double requested_msec;          // total duration passed to fill_buffer()
+    uint64_t submitted_frames;      // total frames passed to alBufferData()
+    uint64_t rendered_frames;       // total frames of device output
+    uint64_t playing_frames;        // frames of device output while source was playing
+    uint64_t silent_frames;         // frames of device output during timed silences
+    int64_t first_play_frame;       // device frame at which source was first started
+    int64_t first_output_frame;     // device frame of first non-zero output sample
+    int max_queued;                 // queue depth, in buffers
+    uint64_t queued_sum;
+    uint64_t queued_count;
+    clock_t start_clock;
+    struct timeval start_time;
+} loopback_stats;
+
+SoundError open_loopback_device(void);
+SoundError open_loopback_device(void)
 {
     SoundError error = SE_NO_ERROR;
+    LPALCLOOPBACKOPENDEVICESOFT loopback_open_device = NULL;
 
-#ifdef GPIO
-    if (gpioInitialise() == 0) {
-    	gpioSetMode(GPIO, PI_OUTPUT);
-    }
-
-#else
-
-    for (int k = 0; k < NUM_BUFFERS; k++) {
-        buffer_queued[k] = false;
+    if (alcIsExtensionPresent(NULL, "ALC_SOFT_loopback")) {
+        loopback_open_device = (LPALCLOOPBACKOPENDEVICESOFT)alcGetProcAddress(NULL, "alcLoopbackOpenDeviceSOFT");
+        render_samples = (LPALCRENDERSAMPLESSOFT)alcGetProcAddress(NULL, "alcRenderSamplesSOFT");
     }
 
-    device = alcOpenDevice(NULL);
-    if (device == NULL) error = SE_NO_DEVICE;
-
-    if (error == SE_NO_ERROR) {
-        context = alcCreateContext(device, NULL);
-        if (context == NULL) error = SE_NO_CONTEXT;
-    }
+    if (loopback_open_device == NULL || render_samples == NULL) error = SE_NO_DEVICE;
 
     if (error == SE_NO_ERROR) {
-        alcMakeContextCurrent(context);
-        error = al_to_se_error(alGetError());
+        device = loopback_open_device(NULL);
+        if (device == NULL) error = SE_NO_DEVICE;
     }
 
     if (error == SE_NO_ERROR) {
-        alGetError();
-        alGenBuffers(NUM_BUFFERS, buffers);
-        error = al_to_se_error(alGetError());
-        buffers_OK = error == SE_NO_ERROR;
-    }
+        ALCint attributes[] = {
+            ALC_FORMAT_CHANNELS_SOFT, ALC_MONO_SOFT,
+            ALC_FORMAT_TYPE_SOFT, ALC_SHORT_SOFT,
+            ALC_FREQUENCY, (ALCint)sample_rate,
+            0
+        };
 
-    if (buffers_OK) {
-        data = (ALshort *)calloc(BUFFER_SIZE, sizeof(ALshort));
-        if (data == NULL) error = SE_OUT_OF_MEMORY;
+        context = alcCreateContext(device, attributes);
+        if (context == NULL) error = SE_NO_CONTEXT;
     }
 
-    if (error == SE_NO_ERROR) {
-        alGenSources(1, &source);
-        error = al_to_se_error(alGetError());
-        source_OK = error == SE_NO_ERROR;
-    }
-#endif
+    memset(&loopback_stats, 0, sizeof(loopback_stats));
+    loopback_stats.first_play_frame = -1;
+    loopback_stats.first_output_frame = -1;
+    loopback_stats.start_clock = clock();
+    gettimeofday(&loopback_stats.start_time, NULL);
 
     return error;
 }
 
-SoundError fill_buffer_or_file(double freq, double msec, FILE *file)
+// render one block of loopback device output, and collect statistics
+void render_loopback(void);
+void render_loopback(void)
 {
-    SoundError error = SE_NO_ERROR;
+    ALint state = AL_STOPPED;
+    ALint queued = 0;
+    ALint processed = 0;
 
-    if (file != NULL) {
-        error = fill_file(freq, msec, file);
+    alGetSourcei(source, AL_SOURCE_STATE, &state);
+    alGetSourcei(source, AL_BUFFERS_QUEUED, &queued);
+    alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
 
-    } else {
-        error = fill_buffer(freq, msec);
+    render_samples(device, loopback_output, LOOPBACK_FRAMES);
+
+    if (state == AL_PLAYING) {
+        loopback_stats.playing_frames += LOOPBACK_FRAMES;
+        if (loopback_stats.first_play_frame < 0) {
+            loopback_stats.first_play_frame = (int64_t)loopback_stats.rendered_frames;
+        }
     }
 
-    return error;
+    if (loopback_stats.first_output_frame < 0) {
+        for (int k = 0; k < LOOPBACK_FRAMES; k++) {
+            if (loopback_output[k] != 0) {
+                loopback_stats.first_output_frame = (int64_t)loopback_stats.rendered_frames + k;
+                break;
+            }
+        }
+    }
+
+    if (queued - processed > loopback_stats.max_queued) loopback_stats.max_queued = queued - processed;
+    loopback_stats.queued_sum += queued - processed;
+    loopback_stats.queued_count++;
+    loopback_stats.rendered_frames += LOOPBACK_FRAMES;
 }
+#endif
+#endif
 
-SoundError fill_buffer(double freq, double msec)
+// A request to preempt what is playing is checked whenever we wait for the device, so it takes
+// effect within a few milliseconds rather than after the queued buffers have been played. What is
+// playing is faded out over PREEMPT_FADE_MSEC (by the source gain with OpenAL, or in the ring
+// buffer with ALSA), and everything queued after it is discarded.
+#define PREEMPT_FADE_MSEC 10.0
+#define PREEMPT_FADE_STEPS 10
+
+PreemptCheck preempt_check = NULL;
+bool preempted = false;
+
+// fade out and stop what the device is playing, and discard anything waiting to be played
+void fade_out_device(void);
+void fade_out_device(void)
 {
-    SoundError error = SE_NO_ERROR;
+    // resampler state belongs to the tone that was cut off
+    if (tone_resampler != NULL) resample_flush(tone_resampler, resampled_tone);
 
-#ifdef GPIO
-#define LONG_1E9 1000000000L
-    struct timespec ts;
+#ifdef ALSA
+    // as is the device resampler's
+    if (pcm_resampler != NULL) resample_flush(pcm_resampler, pcm_output);
 
-    if (freq == 0) {
-        ts.tv_sec = floor(0.001 * msec);
-        ts.tv_nsec = floor((msec - 1000 * ts.tv_sec) * 1000000.0);
-        nanosleep(&ts, NULL);
+    if (pcm != NULL) {
+        int result = -1;
+        snd_pcm_sframes_t rewindable = snd_pcm_rewindable(pcm);
 
-    } else {
-        long nsec_per_half_cycle = (long)((1e9 / freq) / 2);
-        long cycles = (long)(freq * msec / 1000);
+        if (snd_pcm_state(pcm) == SND_PCM_STATE_RUNNING && rewindable > 0 &&
+            snd_pcm_rewind(pcm, (snd_pcm_uframes_t)rewindable) == rewindable) {
+            // samples written after the hardware position are still in the ring buffer; fade the
+            // first of them in place, and leave out the rest
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t offset = 0;
+            snd_pcm_uframes_t frames = (snd_pcm_uframes_t)(0.001 * PREEMPT_FADE_MSEC * pcm_rate);
 
-        clock_gettime(CLOCK_MONOTONIC, &ts);
+            if (frames > (snd_pcm_uframes_t)rewindable) frames = (snd_pcm_uframes_t)rewindable;
+            result = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
 
-        for (long k = 0; k < cycles; k++) {
-        	gpioWrite(GPIO, 1);
+            if (result >= 0) {
+                short *ring = (short *)((char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8);
 
-            ts.tv_nsec += nsec_per_half_cycle;
-            ts.tv_sec += ts.tv_nsec / LONG_1E9;
-            ts.tv_nsec = ts.tv_nsec % LONG_1E9;
-            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                for (snd_pcm_uframes_t k = 0; k < frames; k++) {
+                    double gain = sin(0.5 * M_PI * (double)(frames - k) / (double)frames);
 
-        	gpioWrite(GPIO, 0);
+                    for (unsigned int channel = 0; channel < pcm_channels; channel++, ring++) {
+                        *ring = (short)(*ring * gain);
+                    }
+                }
 
-            ts.tv_nsec += nsec_per_half_cycle;
-            ts.tv_sec += ts.tv_nsec / LONG_1E9;
-            ts.tv_nsec = ts.tv_nsec % LONG_1E9;
-            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, offset, frames);
+                result = committed == (snd_pcm_sframes_t)frames ? snd_pcm_drain(pcm) : -1;
+            }
         }
-    }
-
 
-#else
-    // total - total number of samples
-    // count - samples remaining to be written
-    // index - offset into sequence of samples
-    size_t total = (size_t)(0.001 * msec * SAMPLES_PER_SECOND);
-    size_t count = total;
-    size_t index = 0;
+        if (result < 0) snd_pcm_drop(pcm);
+        snd_pcm_prepare(pcm);
+    }
 
-    // To prevent clicks at beginning and end of tone, ramp amplitude up at beginning and down
-    // at end by multiplying by sine / cosine function. Use RAMP_MSEC or 30% of duration,
-    // whichever is smaller.
-    double max_ramp_msec = msec * 0.30;
-    double ramp_msec = RAMP_MSEC < max_ramp_msec ? RAMP_MSEC : max_ramp_msec;
-    size_t ramp = (size_t)(0.001 * ramp_msec * SAMPLES_PER_SECOND);
+#elif !defined(GPIO)
+    for (int step = 1; step <= PREEMPT_FADE_STEPS; step++) {
+        alSourcef(source, AL_GAIN, (ALfloat)(1.0 - (double)step / PREEMPT_FADE_STEPS));
+        set_streams_gain((ALfloat)(1.0 - (double)step / PREEMPT_FADE_STEPS));
 
-    while (count > 0 && error == SE_NO_ERROR) {
-        while (buffer_queued[current_buffer] && error == SE_NO_ERROR) {
-            // if current buffer is already queued, then they are all queued; need to wait to until
-            // current buffer (which is the oldest queued buffer) is done, so we can start
-            // filling it again
-            ALint processed = 0;
-            while (processed == 0 && error == SE_NO_ERROR) {
-                alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
-                error = al_to_se_error(alGetError());
-            }
+        bool rendered = false;
+        double msec = PREEMPT_FADE_MSEC / PREEMPT_FADE_STEPS;
 
-            if (error == SE_NO_ERROR) {
-                alSourceUnqueueBuffers(source, 1, &buffers[current_buffer]);
-                error = al_to_se_error(alGetError());
-#if DEBUG
-                fprintf(stderr, "[%d] unqueue %d\n", processed, current_buffer);
+#ifdef ALC_SOFT_loopback
+        if (use_loopback) {
+            size_t blocks = ((size_t)(0.001 * msec * sample_rate) + LOOPBACK_FRAMES - 1) / LOOPBACK_FRAMES;
+            for (size_t k = 0; k < blocks; k++) render_loopback();
+            rendered = true;
+        }
 #endif
-            }
 
-            if (error == SE_NO_ERROR) {
-                alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
-#if DEBUG
-                fprintf(stderr, "[%d]\n", processed);
-#endif
-                buffer_queued[current_buffer] = false;
-            }
+        if (!rendered) {
+            struct timespec ts = { 0, (long)(msec * 1000000.0) };
+            nanosleep(&ts, NULL);
         }
+    }
 
-        if (error == SE_NO_ERROR) {
-            // available - space remaining in current buffer
-            size_t available = BUFFER_SIZE - data_offset;
-            // samples - number of samples to write during this cycle through loop
-            size_t samples = count <= available ? count : available;
-
-#if DEBUG
-            fprintf(stderr, "fill buffer %d with %ld samples at %ld (%.1f Hz %f msec)\n", current_buffer, (long)samples,
-                   (long)data_offset, freq, msec);
-#endif
+    // stopping source marks all its buffers processed
+    alSourceStop(source);
+    alSourcef(source, AL_GAIN, 1.0f);
+    stop_streams();
+    set_streams_gain(1.0f);
 
-            write_data(data + data_offset, freq, ramp, total, index, samples);
+    for (int k = 0; k < NUM_BUFFERS; k++) {
+        if (buffer_queued[k]) {
+            alSourceUnqueueBuffers(source, 1, &buffers[k]);
+            buffer_queued[k] = false;
+        }
+    }
 
-            count -= samples;
-            index += samples;
-            data_offset += samples;
+    data_offset = 0;
+    alGetError();
+#endif
+}
 
-            if (data_offset == BUFFER_SIZE) {
-                // buffer is full; write it out
-                alBufferData(buffers[current_buffer], AL_FORMAT_MONO16, data,
-                             (ALsizei)BUFFER_SIZE * sizeof(ALshort), SAMPLES_PER_SECOND);
+// if a request to preempt what is playing has been made, stop playing; returns SE_PREEMPTED from
+// then until the next call of set_preempt_check()
+SoundError check_preemption(void)
+{
+    if (!preempted && preempt_check != NULL && preempt_check()) {
+        fade_out_device();
+        preempted = true;
+    }
 
-                error = al_to_se_error(alGetError());
-#if DEBUG
-                fprintf(stderr, "queue %d\n", current_buffer);
-#endif
+    return preempted ? SE_PREEMPTED : SE_NO_ERROR;
+}
 
-                if (error == SE_NO_ERROR) {
-                    // queue current buffer
-                    alSourceQueueBuffers(source, 1, &buffers[current_buffer]);
-                    buffer_queued[current_buffer] = true;
-                    error = al_to_se_error(alGetError());
-                }
+// called from loops that wait for the device to consume queued buffers: renders loopback output,
+// or sleeps briefly rather than spinning; returns SE_PREEMPTED if playing has been preempted
+#define DEVICE_POLL_NSEC 1000000L
 
-                if (error == SE_NO_ERROR) {
-                    ALint state;
-                    alGetSourcei(source, AL_SOURCE_STATE, &state);
-                    if (state != AL_PLAYING) {
-                        // nothing is playing; either we haven't started yet, or we finished all
-                        // queued buffers.
-
-                        // make sure all except current buffer are unqueued
-                        for (int k = 0; k < NUM_BUFFERS && error == SE_NO_ERROR; k++) {
-                            if (k != current_buffer && buffer_queued[k]) {
-                                alSourceUnqueueBuffers(source, 1, &buffers[k]);
-                                error = al_to_se_error(alGetError());
-#if DEBUG
-                                fprintf(stderr, "unqueue non-playing %d\n", k);
-#endif
-                                buffer_queued[k] = false;
-                            }
-                        }
+SoundError advance_device(void);
+SoundError advance_device(void)
+{
+    bool rendered = false;
 
-                        if (error == SE_NO_ERROR) {
-                            alSourcePlay(source);
-#if DEBUG
-                            fprintf(stderr, "play\n");
+#ifdef ALC_SOFT_loopback
+    if (use_loopback) {
+        render_loopback();
+        rendered = true;
+    }
 #endif
-                            error = al_to_se_error(alGetError());
-                        }
-                    }
-                }
 
-                current_buffer = (current_buffer + 1) % NUM_BUFFERS;
-                data_offset = 0;
-            }
-        }
+    if (!rendered) {
+        struct timespec ts = { 0, DEVICE_POLL_NSEC };
+        nanosleep(&ts, NULL);
     }
+
+#if !defined(GPIO) && !defined(ALSA)
+    // background streams are kept playing while we wait
+    SoundError error = pump_streams(false);
+    if (error != SE_NO_ERROR) return error;
 #endif
 
-    return error;
+    return check_preemption();
 }
 
-#define WAVE_HEADER_SIZE 44
+// count frames passed to device, for statistics
+void count_submitted(double msec, size_t frames);
+void count_submitted(double msec, size_t frames)
+{
+#ifdef ALC_SOFT_loopback
+    loopback_stats.requested_msec += msec;
+    loopback_stats.submitted_frames += frames;
+#endif
+}
+
+#if !defined(GPIO) && !defined(ALSA)
+// wait until current buffer is free to be filled
+SoundError wait_for_current_buffer(void);
+SoundError wait_for_current_buffer(void)
+{
+    SoundError error = SE_NO_ERROR;
+
+    while (buffer_queued[current_buffer] && error == SE_NO_ERROR) {
+        // if current buffer is already queued, then they are all queued; need to wait to until
+        // current buffer (which is the oldest queued buffer) is done, so we can start
+        // filling it again
+        ALint processed = 0;
+        while (processed == 0 && error == SE_NO_ERROR) {
+            alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+            error = al_to_se_error(alGetError());
+            if (processed == 0) error = advance_device();
+        }
+
+        if (error == SE_NO_ERROR) {
+            alSourceUnqueueBuffers(source, 1, &buffers[current_buffer]);
+            error = al_to_se_error(alGetError());
+#if DEBUG
+            fprintf(stderr, "[%d] unqueue %d\n", processed, current_buffer);
+#endif
+        }
+
+        if (error == SE_NO_ERROR) {
+            alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+#if DEBUG
+            fprintf(stderr, "[%d]\n", processed);
+#endif
+            buffer_queued[current_buffer] = false;
+        }
+    }
+
+    return error;
+}
+
+// copy samples into current buffer and queue it, starting source if it isn't playing; moves on
+// to next buffer
+SoundError queue_current_buffer(const ALshort *samples, size_t count, unsigned int rate);
+SoundError queue_current_buffer(const ALshort *samples, size_t count, unsigned int rate)
+{
+    // nothing more is played once playing has been preempted
+    SoundError error = check_preemption();
+    if (error != SE_NO_ERROR) {
+        data_offset = 0;
+        return error;
+    }
+
+    alBufferData(buffers[current_buffer], AL_FORMAT_MONO16, samples, (ALsizei)(count * sizeof(ALshort)),
+                 (ALsizei)rate);
+
+    error = al_to_se_error(alGetError());
+#if DEBUG
+    fprintf(stderr, "queue %d\n", current_buffer);
+#endif
+
+    if (error == SE_NO_ERROR) {
+        // queue current buffer
+        alSourceQueueBuffers(source, 1, &buffers[current_buffer]);
+        buffer_queued[current_buffer] = true;
+        error = al_to_se_error(alGetError());
+    }
+
+    if (error == SE_NO_ERROR) {
+        ALint state;
+        alGetSourcei(source, AL_SOURCE_STATE, &state);
+        if (state != AL_PLAYING) {
+            // nothing is playing; either we haven't started yet, or we finished all
+            // queued buffers.
+
+            // make sure all except current buffer are unqueued
+            for (int k = 0; k < NUM_BUFFERS && error == SE_NO_ERROR; k++) {
+                if (k != current_buffer && buffer_queued[k]) {
+                    alSourceUnqueueBuffers(source, 1, &buffers[k]);
+                    error = al_to_se_error(alGetError());
+#if DEBUG
+                    fprintf(stderr, "unqueue non-playing %d\n", k);
+#endif
+                    buffer_queued[k] = false;
+                }
+            }
+
+            if (error == SE_NO_ERROR) {
+                alSourcePlay(source);
+#if DEBUG
+                fprintf(stderr, "play\n");
+#endif
+                error = al_to_se_error(alGetError());
+            }
+        }
+    }
+
+    current_buffer = (current_buffer + 1) % NUM_BUFFERS;
+    data_offset = 0;
+
+    return error;
+}
+
+// Background streams: each has its own source and buffer ring, and OpenAL mixes them with the
+// main stream (stream 0, which uses source above). Tones given to a background stream are queued
+// as frequency and duration, and are rendered into its buffers whenever one is free: as they are
+// given, and whenever we wait for the device (see advance_device()), so that the stream plays on
+// while later options run. A buffer is only queued once enough tones have been given to fill
+// much of it, rather than one short buffer per tone; wait_for_streams() queues what is left.
+// Tones are rendered at sample_rate, without --synth-rate.
+#define MAX_STREAMS 8
+#define MIN_STREAM_TONES 64
+#define MIN_STREAM_QUEUE (buffer_size / 2)
+
+struct StreamTone {
+    double freq;
+    double msec;
+};
+typedef struct StreamTone StreamTone;
+
+struct Stream {
+    bool OK;                        // source and buffers have been generated
+    ALuint source;
+    ALuint buffers[NUM_BUFFERS];
+    bool buffer_queued[NUM_BUFFERS];
+    int current_buffer;
+    ALshort *data;
+    size_t data_offset;
+    StreamTone *tones;              // tones not yet rendered
+    size_t tone_capacity;
+    size_t tone_count;
+    size_t first_tone;
+    size_t tone_index;              // samples of first tone already rendered
+};
+typedef struct Stream Stream;
+
+Stream streams[MAX_STREAMS];        // streams[0] isn't used
+
+// generate source and buffers of stream
+SoundError open_stream(Stream *stream);
+SoundError open_stream(Stream *stream)
+{
+    SoundError error = SE_NO_ERROR;
+
+    stream->data = (ALshort *)malloc(buffer_size * sizeof(ALshort));
+    if (stream->data == NULL) error = SE_OUT_OF_MEMORY;
+
+    if (error == SE_NO_ERROR) {
+        alGenSources(1, &stream->source);
+        error = al_to_se_error(alGetError());
+    }
+
+    if (error == SE_NO_ERROR) {
+        alGenBuffers(NUM_BUFFERS, stream->buffers);
+        error = al_to_se_error(alGetError());
+        if (error != SE_NO_ERROR) alDeleteSources(1, &stream->source);
+    }
+
+    if (error == SE_NO_ERROR) {
+        stream->OK = true;
+
+    } else {
+        free(stream->data);
+        stream->data = NULL;
+    }
+
+    return error;
+}
+
+// unqueue buffers that stream has played
+SoundError unqueue_stream_buffers(Stream *stream);
+SoundError unqueue_stream_buffers(Stream *stream)
+{
+    ALint processed = 0;
+
+    alGetSourcei(stream->source, AL_BUFFERS_PROCESSED, &processed);
+    SoundError error = al_to_se_error(alGetError());
+
+    for (ALint k = 0; k < processed && error == SE_NO_ERROR; k++) {
+        ALuint buffer;
+
+        alSourceUnqueueBuffers(stream->source, 1, &buffer);
+        error = al_to_se_error(alGetError());
+
+        for (int n = 0; n < NUM_BUFFERS; n++) {
+            if (stream->buffers[n] == buffer) stream->buffer_queued[n] = false;
+        }
+    }
+
+    return error;
+}
+
+// render tones of stream into its free buffers, and queue them; a buffer is queued when it is
+// full, or holds at least MIN_STREAM_QUEUE of the stream's last tones; with drain, whatever has
+// been rendered is queued (see wait_for_streams())
+SoundError pump_stream(Stream *stream, bool drain);
+SoundError pump_stream(Stream *stream, bool drain)
+{
+    SoundError error = unqueue_stream_buffers(stream);
+
+    while (error == SE_NO_ERROR && !stream->buffer_queued[stream->current_buffer] &&
+           (stream->first_tone < stream->tone_count || (drain && stream->data_offset > 0))) {
+        while (stream->first_tone < stream->tone_count && stream->data_offset < buffer_size) {
+            const StreamTone *tone = &stream->tones[stream->first_tone];
+            size_t total = (size_t)(0.001 * tone->msec * sample_rate);
+            double max_ramp_msec = tone->msec * 0.30;
+            double ramp_msec = RAMP_MSEC < max_ramp_msec ? RAMP_MSEC : max_ramp_msec;
+            size_t ramp = (size_t)(0.001 * ramp_msec * sample_rate);
+            size_t available = buffer_size - stream->data_offset;
+            size_t samples = total - stream->tone_index < available ? total - stream->tone_index : available;
+
+            write_data(stream->data + stream->data_offset, tone->freq, ramp, total, stream->tone_index, samples);
+
+            stream->data_offset += samples;
+            stream->tone_index += samples;
+
+            if (stream->tone_index == total) {
+                stream->first_tone++;
+                stream->tone_index = 0;
+            }
+        }
+
+        // a short buffer would be queued for every tone given; wait for more of them instead
+        if (!drain && stream->data_offset < MIN_STREAM_QUEUE) break;
+
+        ALuint buffer = stream->buffers[stream->current_buffer];
+        alBufferData(buffer, AL_FORMAT_MONO16, stream->data, (ALsizei)(stream->data_offset * sizeof(ALshort)),
+                     (ALsizei)sample_rate);
+        error = al_to_se_error(alGetError());
+
+        if (error == SE_NO_ERROR) {
+            alSourceQueueBuffers(stream->source, 1, &buffer);
+            error = al_to_se_error(alGetError());
+        }
+
+        if (error == SE_NO_ERROR) {
+            ALint state;
+
+            stream->buffer_queued[stream->current_buffer] = true;
+            stream->current_buffer = (stream->current_buffer + 1) % NUM_BUFFERS;
+            stream->data_offset = 0;
+
+            alGetSourcei(stream->source, AL_SOURCE_STATE, &state);
+            if (state != AL_PLAYING) alSourcePlay(stream->source);
+            error = al_to_se_error(alGetError());
+        }
+    }
+
+    if (stream->first_tone == stream->tone_count) {
+        stream->tone_count = 0;
+        stream->first_tone = 0;
+    }
+
+    return error;
+}
+
+// queue tone on current stream
+SoundError stream_tone(double freq, double msec);
+SoundError stream_tone(double freq, double msec)
+{
+    SoundError error = check_preemption();
+    Stream *stream = &streams[current_stream];
+
+    if (error == SE_NO_ERROR && !stream->OK) error = open_stream(stream);
+
+    if (error == SE_NO_ERROR && stream->tone_count == stream->tone_capacity) {
+        size_t capacity = stream->tone_capacity > 0 ? 2 * stream->tone_capacity : MIN_STREAM_TONES;
+        StreamTone *tones = (StreamTone *)realloc(stream->tones, capacity * sizeof(StreamTone));
+
+        if (tones == NULL) {
+            error = SE_OUT_OF_MEMORY;
+
+        } else {
+            stream->tones = tones;
+            stream->tone_capacity = capacity;
+        }
+    }
+
+    if (error == SE_NO_ERROR) {
+        stream->tones[stream->tone_count].freq = freq;
+        stream->tones[stream->tone_count].msec = msec;
+        stream->tone_count++;
+
+        error = pump_stream(stream, false);
+    }
+
+    return error;
+}
+
+// keep background streams playing; with drain, partly filled buffers are queued too
+SoundError pump_streams(bool drain)
+{
+    SoundError error = SE_NO_ERROR;
+
+    for (int k = 1; k < MAX_STREAMS && error == SE_NO_ERROR; k++) {
+        if (streams[k].OK) error = pump_stream(&streams[k], drain);
+    }
+
+    return error;
+}
+
+// true if stream has tones or buffers left to play
+bool stream_busy(Stream *stream);
+bool stream_busy(Stream *stream)
+{
+    bool busy = false;
+
+    if (stream->OK) {
+        ALint state;
+        alGetSourcei(stream->source, AL_SOURCE_STATE, &state);
+
+        busy = stream->first_tone < stream->tone_count || stream->data_offset > 0 || state == AL_PLAYING;
+    }
+
+    return busy;
+}
+
+// stop stream now, and discard what it has left to play
+void stop_background_stream(Stream *stream);
+void stop_background_stream(Stream *stream)
+{
+    if (stream->OK) {
+        alSourceStop(stream->source);
+
+        // stopping source marks all its buffers processed
+        unqueue_stream_buffers(stream);
+        alGetError();
+    }
+
+    stream->tone_count = 0;
+    stream->first_tone = 0;
+    stream->tone_index = 0;
+    stream->data_offset = 0;
+}
+
+void set_streams_gain(ALfloat gain)
+{
+    for (int k = 1; k < MAX_STREAMS; k++) {
+        if (streams[k].OK) alSourcef(streams[k].source, AL_GAIN, gain);
+    }
+}
+
+void stop_streams(void)
+{
+    for (int k = 1; k < MAX_STREAMS; k++) stop_background_stream(&streams[k]);
+}
+
+void close_streams(void)
+{
+    for (int k = 1; k < MAX_STREAMS; k++) {
+        Stream *stream = &streams[k];
+
+        if (stream->OK) {
+            alSourceStop(stream->source);
+            alDeleteSources(1, &stream->source);
+            alDeleteBuffers(NUM_BUFFERS, stream->buffers);
+        }
+
+        free(stream->data);
+        free(stream->tones);
+        memset(stream, 0, sizeof(Stream));
+    }
+}
+#endif
+
+// select output device by name; must be called before init_sound()
+void set_sound_device(const char *name)
+{
+    device_name = name;
+}
+
+// set rate for synthesis and .wav output, or 0 to use device's native rate; must be called before
+// init_sound()
+SoundError set_sample_rate(unsigned int rate)
+{
+    SoundError error = SE_NO_ERROR;
+
+    switch (rate) {
+        case 0:
+            use_native_rate = true;
+            rate_requested = false;
+            break;
+
+        case 8000:
+        case 16000:
+        case 22050:
+        case 44100:
+        case 48000:
+        case 96000:
+            sample_rate = rate;
+            use_native_rate = false;
+            rate_requested = true;
+            break;
+
+        default:
+            error = SE_INVALID_RATE;
+            break;
+    }
+
+    return error;
+}
+
+// synthesize tones at rate, and resample them to the sample rate; 0 to synthesize at the sample
+// rate. Must be called before init_sound().
+SoundError set_synth_rate(unsigned int rate)
+{
+    SoundError error = SE_NO_ERROR;
+
+    switch (rate) {
+        case 0:
+        case 8000:
+        case 16000:
+        case 22050:
+        case 44100:
+        case 48000:
+        case 96000:
+            synth_rate = rate;
+            break;
+
+        default:
+            error = SE_INVALID_RATE;
+            break;
+    }
+
+    return error;
+}
+
+// set quality of resampling for tones synthesized at another rate, and for .wav files played
+void set_resample_quality(ResampleQuality quality)
+{
+    resample_quality = quality;
+}
+
+// use loopback device, rendering in accelerated time; must be called before init_sound()
+SoundError set_loopback(bool enabled)
+{
+#ifdef ALC_SOFT_loopback
+    use_loopback = enabled;
+    return SE_NO_ERROR;
+
+#else
+    return enabled ? SE_INVALID_OPTION : SE_NO_ERROR;
+#endif
+}
+
+// set function called to check for a request to preempt what is playing (or NULL), and start
+// playing again if playing was preempted
+void set_preempt_check(PreemptCheck check)
+{
+    preempt_check = check;
+    preempted = false;
+}
+
+// print measurements of loopback device output
+void print_loopback_statistics(FILE *file)
+{
+#ifdef ALC_SOFT_loopback
+    if (use_loopback) {
+        struct timeval end_time;
+        gettimeofday(&end_time, NULL);
+
+        double cpu_sec = (double)(clock() - loopback_stats.start_clock) / CLOCKS_PER_SEC;
+        double wall_sec = (double)(end_time.tv_sec - loopback_stats.start_time.tv_sec) +
+            1e-6 * (end_time.tv_usec - loopback_stats.start_time.tv_usec);
+        double msec_per_frame = 1000.0 / sample_rate;
+        double submitted_msec = loopback_stats.submitted_frames * msec_per_frame;
+        double playing_msec = (loopback_stats.playing_frames + loopback_stats.silent_frames) * msec_per_frame;
+        double audio_sec = 0.001 * loopback_stats.rendered_frames * msec_per_frame;
+
+        fprintf(file, "Loopback device at %u Hz\n", sample_rate);
+        fprintf(file, "Requested duration %.1f msec\n", loopback_stats.requested_msec);
+        fprintf(file, "Submitted duration %.1f msec (%+.1f msec)\n", submitted_msec,
+                submitted_msec - loopback_stats.requested_msec);
+        fprintf(file, "Played duration %.1f msec (%+.1f msec, resolution %.1f msec)\n", playing_msec,
+                playing_msec - loopback_stats.requested_msec, LOOPBACK_FRAMES * msec_per_frame);
+
+        if (loopback_stats.silent_frames > 0) {
+            fprintf(file, "Timed silence %.1f msec\n", loopback_stats.silent_frames * msec_per_frame);
+        }
+
+        if (loopback_stats.first_output_frame >= 0 && loopback_stats.first_play_frame >= 0) {
+            fprintf(file, "First output latency %.1f msec\n",
+                    (loopback_stats.first_output_frame - loopback_stats.first_play_frame) * msec_per_frame);
+        }
+
+        if (loopback_stats.queued_count > 0) {
+            fprintf(file, "Queue depth max %d, average %.2f buffers\n", loopback_stats.max_queued,
+                    (double)loopback_stats.queued_sum / loopback_stats.queued_count);
+        }
+
+        fprintf(file, "CPU time %.3f sec, %.2f msec per second of audio\n", cpu_sec,
+                audio_sec > 0.0 ? 1000.0 * cpu_sec / audio_sec : 0.0);
+        fprintf(file, "Rendered %.1f sec of audio in %.3f sec (%.0fx real time)\n", audio_sec, wall_sec,
+                wall_sec > 0.0 ? audio_sec / wall_sec : 0.0);
+    }
+#endif
+}
+
+SoundError init_sound(void)
+{
+    SoundError error = SE_NO_ERROR;
+
+#ifdef GPIO
+    if (gpioInitialise() == 0) {
+    	gpioSetMode(GPIO, PI_OUTPUT);
+    }
+
+#elif defined(ALSA)
+    int result = snd_pcm_open(&pcm, device_name != NULL ? device_name : ALSA_DEFAULT_DEVICE,
+                              SND_PCM_STREAM_PLAYBACK, 0);
+    if (result < 0) {
+        pcm = NULL;
+        error = SE_NO_DEVICE;
+    }
+
+    // unless a particular rate was requested (or resampling is left to the device), use a rate
+    // the device supports natively; only with --rate native are tones synthesized at that rate
+    unsigned int device_rate = sample_rate;
+    if (error == SE_NO_ERROR) error = alsa_configure(&device_rate, rate_requested || resample_quality == RQ_DEVICE);
+    if (error == SE_NO_ERROR && use_native_rate) sample_rate = pcm_rate;
+    if (error == SE_NO_ERROR) error = alsa_set_input_rate(sample_rate);
+
+#else
+
+    for (int k = 0; k < NUM_BUFFERS; k++) {
+        buffer_queued[k] = false;
+    }
+
+#ifdef ALC_SOFT_loopback
+    if (use_loopback) {
+        error = open_loopback_device();
+
+    } else
+#endif
+    {
+        device = alcOpenDevice(device_name);
+        if (device == NULL) error = SE_NO_DEVICE;
+
+        if (error == SE_NO_ERROR) {
+            // if a rate was requested, have the mixer run at that rate so it does not resample
+            ALCint attributes[] = { ALC_FREQUENCY, (ALCint)sample_rate, 0 };
+
+            context = alcCreateContext(device, rate_requested ? attributes : NULL);
+            if (context == NULL) error = SE_NO_CONTEXT;
+        }
+
+        if (error == SE_NO_ERROR && use_native_rate) {
+            // use device's own mixing rate
+            ALCint frequency = 0;
+            alcGetIntegerv(device, ALC_FREQUENCY, 1, &frequency);
+            if (frequency > 0) sample_rate = (unsigned int)frequency;
+        }
+    }
+
+    if (error == SE_NO_ERROR) {
+        alcMakeContextCurrent(context);
+        error = al_to_se_error(alGetError());
+    }
+
+    if (error == SE_NO_ERROR) {
+        alGetError();
+        alGenBuffers(NUM_BUFFERS, buffers);
+        error = al_to_se_error(alGetError());
+        buffers_OK = error == SE_NO_ERROR;
+    }
+
+    if (buffers_OK) {
+        buffer_size = BUFFER_SECONDS * sample_rate;
+        data = (ALshort *)calloc(buffer_size, sizeof(ALshort));
+        if (data == NULL) error = SE_OUT_OF_MEMORY;
+    }
+
+    if (error == SE_NO_ERROR) {
+        alGenSources(1, &source);
+        error = al_to_se_error(alGetError());
+        source_OK = error == SE_NO_ERROR;
+    }
+#endif
+
+    return error;
+}
+
+// rate tones are synthesized at
+unsigned int tone_rate(void)
+{
+    return synth_rate != 0 ? synth_rate : sample_rate;
+}
+
+// true if tones are synthesized at a different rate and resampled
+bool tones_resampled(void);
+bool tones_resampled(void)
+{
+    return synth_rate != 0 && synth_rate != sample_rate;
+}
+
+// number of samples in a tone or gap written to a .wav file, before resampling
+size_t msec_to_samples(double msec);
+size_t msec_to_samples(double msec)
+{
+    return (size_t)(0.001 * msec * tone_rate());
+}
+
+// count samples of tone or silence as fill_resampled() writes them: tones are resampled, and what
+// the resampler holds goes out before silence, which is at sample_rate
+void count_samples(double freq, double msec);
+void count_samples(double freq, double msec)
+{
+    if (!tones_resampled()) {
+        counted_samples += msec_to_samples(msec);
+
+    } else if (freq == SILENCE) {
+        counted_samples += resampled_count(counted_tone_samples, synth_rate, sample_rate);
+        counted_samples += (uint64_t)(0.001 * msec * sample_rate);
+        counted_tone_samples = 0;
+
+    } else {
+        counted_tone_samples += msec_to_samples(msec);
+    }
+}
+
+// tones are recorded instead of rendered while compiling a tone program (see program.h)
+ToneRecorder tone_recorder = NULL;
+
+void set_tone_recorder(ToneRecorder recorder)
+{
+    tone_recorder = recorder;
+}
+
+SoundError fill_buffer_or_file(double freq, double msec, FILE *file)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (tone_recorder != NULL) {
+        error = tone_recorder(freq, msec, 0.0, 1, false);
+
+    } else if (counting_samples) {
+        if (file != NULL) count_samples(freq, msec);
+
+    } else if (file == NULL && current_stream > 0) {
+        // background streams are rendered at the output rate
+        error = fill_buffer(freq, msec);
+
+    } else if (tones_resampled()) {
+        error = fill_resampled(freq, msec, file);
+
+    } else if (file != NULL) {
+        error = fill_file(freq, msec, file);
+
+    } else {
+        error = fill_buffer(freq, msec);
+    }
+
+    return error;
+}
+
+// Long silences on the device are time rather than samples: once everything before them has been
+// played, nothing is sent to the device until the silence is over (the loopback device renders it
+// instead). Restarting the device afterwards may add up to one device period to the silence. The
+// silence is waited out in steps of SILENCE_STEP_MSEC, so that it can be preempted.
+#ifndef GPIO
+#define MIN_TIMED_SILENCE_MSEC 500.0
+#define SILENCE_STEP_MSEC 10.0
+#define LONG_1E9 1000000000L
+
+SoundError wait_silence(double msec);
+SoundError wait_silence(double msec)
+{
+    size_t total = (size_t)(0.001 * msec * sample_rate);
+    bool rendered = false;
+
+    SoundError error = play_buffers();
+    if (error == SE_NO_ERROR) error = wait_for_buffers();
+
+    count_submitted(msec, total);
+
+#ifdef ALC_SOFT_loopback
+    if (error == SE_NO_ERROR && use_loopback) {
+        size_t blocks = (total + LOOPBACK_FRAMES / 2) / LOOPBACK_FRAMES;
+
+        for (size_t k = 0; k < blocks && error == SE_NO_ERROR; k++) {
+            render_loopback();
+            loopback_stats.silent_frames += LOOPBACK_FRAMES;
+            error = pump_streams(false);
+            if (error == SE_NO_ERROR) error = check_preemption();
+        }
+
+        rendered = true;
+    }
+#endif
+
+    if (error == SE_NO_ERROR && !rendered) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (double done = 0.0; done < msec && error == SE_NO_ERROR; done += SILENCE_STEP_MSEC) {
+            double step_end = done + SILENCE_STEP_MSEC < msec ? done + SILENCE_STEP_MSEC : msec;
+            long nsec = start.tv_nsec + (long)(fmod(step_end, 1000.0) * 1000000.0);
+            struct timespec ts;
+
+            ts.tv_sec = start.tv_sec + (time_t)floor(0.001 * step_end) + nsec / LONG_1E9;
+            ts.tv_nsec = nsec % LONG_1E9;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+#ifndef ALSA
+            error = pump_streams(false);
+            if (error == SE_NO_ERROR) error = check_preemption();
+#else
+            error = check_preemption();
+#endif
+        }
+    }
+
+    return error;
+}
+#endif
+
+SoundError fill_buffer(double freq, double msec)
+{
+    SoundError error = SE_NO_ERROR;
+
+#ifdef GPIO
+#define LONG_1E9 1000000000L
+    struct timespec ts;
+
+    if (freq == 0) {
+        ts.tv_sec = floor(0.001 * msec);
+        ts.tv_nsec = floor((msec - 1000 * ts.tv_sec) * 1000000.0);
+        nanosleep(&ts, NULL);
+
+    } else {
+        long nsec_per_half_cycle = (long)((1e9 / freq) / 2);
+        long cycles = (long)(freq * msec / 1000);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        for (long k = 0; k < cycles; k++) {
+        	gpioWrite(GPIO, 1);
+
+            ts.tv_nsec += nsec_per_half_cycle;
+            ts.tv_sec += ts.tv_nsec / LONG_1E9;
+            ts.tv_nsec = ts.tv_nsec % LONG_1E9;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        	gpioWrite(GPIO, 0);
+
+            ts.tv_nsec += nsec_per_half_cycle;
+            ts.tv_sec += ts.tv_nsec / LONG_1E9;
+            ts.tv_nsec = ts.tv_nsec % LONG_1E9;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+    }
+
+#elif defined(ALSA)
+    size_t total = (size_t)(0.001 * msec * sample_rate);
+    double max_ramp_msec = msec * 0.30;
+    double ramp_msec = RAMP_MSEC < max_ramp_msec ? RAMP_MSEC : max_ramp_msec;
+    size_t ramp = (size_t)(0.001 * ramp_msec * sample_rate);
+
+    if (freq == SILENCE && msec >= MIN_TIMED_SILENCE_MSEC) {
+        error = wait_silence(msec);
+
+    } else {
+        if (pcm_input_rate != sample_rate) error = alsa_set_rate(sample_rate, false);
+        if (error == SE_NO_ERROR) error = alsa_play(NULL, freq, ramp, total, 0, total);
+    }
+
+#else
+    // tones for a background stream are queued on it, and rendered as its buffers become free
+    if (current_stream > 0) return stream_tone(freq, msec);
+
+    // total - total number of samples
+    // count - samples remaining to be written
+    // index - offset into sequence of samples
+    size_t total = (size_t)(0.001 * msec * sample_rate);
+    size_t count = total;
+    size_t index = 0;
+
+    // To prevent clicks at beginning and end of tone, ramp amplitude up at beginning and down
+    // at end by multiplying by sine / cosine function. Use RAMP_MSEC or 30% of duration,
+    // whichever is smaller.
+    double max_ramp_msec = msec * 0.30;
+    double ramp_msec = RAMP_MSEC < max_ramp_msec ? RAMP_MSEC : max_ramp_msec;
+    size_t ramp = (size_t)(0.001 * ramp_msec * sample_rate);
+
+    if (freq == SILENCE && msec >= MIN_TIMED_SILENCE_MSEC) {
+        error = wait_silence(msec);
+        count = 0;
+
+    } else {
+        count_submitted(msec, total);
+    }
+
+    while (count > 0 && error == SE_NO_ERROR) {
+        error = wait_for_current_buffer();
+
+        if (error == SE_NO_ERROR) {
+            // available - space remaining in current buffer
+            size_t available = buffer_size - data_offset;
+            // samples - number of samples to write during this cycle through loop
+            size_t samples = count <= available ? count : available;
+
+#if DEBUG
+            fprintf(stderr, "fill buffer %d with %ld samples at %ld (%.1f Hz %f msec)\n", current_buffer, (long)samples,
+                   (long)data_offset, freq, msec);
+#endif
+
+            write_data(data + data_offset, freq, ramp, total, index, samples);
+
+            count -= samples;
+            index += samples;
+            data_offset += samples;
+
+            // buffer is full; write it out
+            if (data_offset == buffer_size) error = queue_current_buffer(data, buffer_size, sample_rate);
+        }
+    }
+#endif
+
+    return error;
+}
+
+#define RIFF_HEADER_SIZE 12
+#define DS64_CHUNK_SIZE 36
+#define BUF_SIZE 4096
+
+SoundError write_file_samples(const float *samples, size_t count, FILE *file);
+
+// play 16-bit samples at sample_rate
+SoundError buffer_samples(const int16_t *samples, size_t count);
+SoundError buffer_samples(const int16_t *samples, size_t count)
+{
+    SoundError error = SE_NO_ERROR;
+
+#ifdef ALSA
+    if (pcm_input_rate != sample_rate) error = alsa_set_rate(sample_rate, false);
+    if (error == SE_NO_ERROR) error = alsa_play(samples, 0.0, 0, 0, 0, count);
+
+#elif !defined(GPIO)
+    while (count > 0 && error == SE_NO_ERROR) {
+        error = wait_for_current_buffer();
+
+        if (error == SE_NO_ERROR) {
+            size_t available = buffer_size - data_offset;
+            size_t block = count <= available ? count : available;
+
+            memcpy(data + data_offset, samples, block * sizeof(ALshort));
+
+            samples += block;
+            count -= block;
+            data_offset += block;
+
+            // buffer is full; write it out
+            if (data_offset == buffer_size) error = queue_current_buffer(data, buffer_size, sample_rate);
+        }
+    }
+#endif
+
+    return error;
+}
+
+// write resampled tone to file, or play it
+SoundError put_resampled(const float *samples, size_t count, FILE *file);
+SoundError put_resampled(const float *samples, size_t count, FILE *file)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (file != NULL) {
+        error = write_file_samples(samples, count, file);
+
+    } else {
+        int16_t buffer[BUF_SIZE];
+
+        count_submitted(0.0, count);
+
+        while (count > 0 && error == SE_NO_ERROR) {
+            size_t block = count < BUF_SIZE ? count : BUF_SIZE;
+
+            float_to_int16(samples, buffer, block, false);
+            error = buffer_samples(buffer, block);
+
+            samples += block;
+            count -= block;
+        }
+    }
+
+    return error;
+}
+
+// synthesize tone at synth_rate and resample it to sample_rate, for file or device
+SoundError fill_resampled(double freq, double msec, FILE *file)
+{
+    SoundError error = SE_NO_ERROR;
+
+#ifdef GPIO
+    // GPIO pin is toggled at the tone frequency; there are no samples to resample
+    if (file == NULL) return fill_buffer(freq, msec);
+#endif
+
+    size_t total = msec_to_samples(msec);
+    double max_ramp_msec = msec * 0.30;
+    double ramp_msec = RAMP_MSEC < max_ramp_msec ? RAMP_MSEC : max_ramp_msec;
+    size_t ramp = (size_t)(0.001 * ramp_msec * synth_rate);
+
+    int16_t synthesized[BUF_SIZE];
+    float samples[BUF_SIZE];
+
+    if (tone_resampler == NULL) {
+        tone_resampler = new_resampler(synth_rate, sample_rate, resample_quality);
+
+        if (tone_resampler != NULL) {
+            resampled_tone = (float *)malloc(resample_capacity(tone_resampler, BUF_SIZE) * sizeof(float));
+        }
+
+        if (tone_resampler == NULL || resampled_tone == NULL) error = SE_OUT_OF_MEMORY;
+    }
+
+    // tail of previous tone goes where it was headed; before silence, which isn't resampled, it
+    // goes out now
+    if (error == SE_NO_ERROR && (file != tone_file || freq == SILENCE)) error = flush_resampled(tone_file);
+    tone_file = file;
+
+    // silence goes the way it does without resampling, as sample_rate samples (or a wait)
+    if (freq == SILENCE) {
+        if (error == SE_NO_ERROR) error = file == NULL ? fill_buffer(freq, msec) : fill_file(freq, msec, file);
+        return error;
+    }
+
+    if (file == NULL) count_submitted(msec, 0);
+
+    for (size_t index = 0; index < total && error == SE_NO_ERROR; index += BUF_SIZE) {
+        size_t count = total - index < BUF_SIZE ? total - index : BUF_SIZE;
+
+        // synthesize as 16-bit samples, so that fixed-point synthesis is used if selected
+        write_data(synthesized, freq, ramp, total, index, count);
+        frames_to_float((const uint8_t *)synthesized, samples, count, 1, 16, false);
+
+        size_t produced = resample(tone_resampler, samples, count, resampled_tone);
+        error = put_resampled(resampled_tone, produced, file);
+    }
+
+    return error;
+}
+
+// write or play the end of the resampled tones
+SoundError flush_resampled(FILE *file)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (tone_resampler != NULL && !counting_samples) {
+        size_t produced = resample_flush(tone_resampler, resampled_tone);
+        if (produced > 0) error = put_resampled(resampled_tone, produced, file);
+    }
+
+    return error;
+}
+
+// start .wav file; header is written with the first samples
+SoundError begin_wave_file(FILE *file)
+{
+    SoundError error = SE_NO_ERROR;
+
+    // pipes, sockets and terminals can't report (or change) their position
+    wave_seekable = ftell(file) >= 0;
+    wave_header_pending = true;
+    wave_header_size = 0;
+    wave_data_size = 0;
+    wave_sample_count = 0;
+    adpcm_fill = 0;
+    adpcm_index = 0;
+
+    return error;
+}
+
+// write .wav file without header
+void set_raw_output(bool enabled)
+{
+    raw_output = enabled;
+}
+
+// set number of samples to be written to .wav file, so that exact sizes can be put in the header
+// of a stream that can't be rewound
+void set_wave_sample_count(uint64_t count)
+{
+    wave_count = count;
+    wave_count_known = true;
+    wave_count_rate = sample_rate;
+}
+
+// count samples that would be written to .wav file, without writing or playing anything
+void begin_sample_count(void)
+{
+    counting_samples = true;
+    counted_samples = 0;
+    counted_tone_samples = 0;
+}
+
+// stop counting samples; returns number of samples counted
+uint64_t end_sample_count(void)
+{
+    counting_samples = false;
+    return tones_resampled() ? counted_samples + resampled_count(counted_tone_samples, synth_rate, sample_rate) :
+                               counted_samples;
+}
+
+#define CHANNELS 1
+
+// set format of samples written to .wav file
+SoundError set_output_format(SampleFormat format)
+{
+    SoundError error = SE_NO_ERROR;
+
+    switch (format) {
+        case SF_PCM16:
+        case SF_PCM24:
+        case SF_FLOAT:
+        case SF_ULAW:
+        case SF_ALAW:
+        case SF_ADPCM:
+            output_format = format;
+            break;
+
+        default:
+            error = SE_INVALID_VALUE;
+            break;
+    }
+
+    return error;
+}
+
+// add TPDF dither when reducing to 16-bit .wav file samples
+void set_dither(bool enabled)
+{
+    use_dither = enabled;
+}
+
+// format tag of "fmt " chunk
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_ALAW 6
+#define WAVE_FORMAT_MULAW 7
+#define WAVE_FORMAT_IMA_ADPCM 0x11
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+uint16_t output_format_tag(void);
+uint16_t output_format_tag(void)
+{
+    switch (output_format) {
+        case SF_FLOAT:  return WAVE_FORMAT_IEEE_FLOAT;
+        case SF_ULAW:   return WAVE_FORMAT_MULAW;
+        case SF_ALAW:   return WAVE_FORMAT_ALAW;
+        case SF_ADPCM:  return WAVE_FORMAT_IMA_ADPCM;
+        case SF_PCM16:
+        case SF_PCM24:
+        default:        return WAVE_FORMAT_PCM;
+    }
+}
+
+// true if output format is linear, so that silence is all zero bytes
+bool output_is_linear(void);
+bool output_is_linear(void)
+{
+    return output_format == SF_PCM16 || output_format == SF_PCM24 || output_format == SF_FLOAT;
+}
+
+// size of one block of output format, in bytes: one sample, or for ADPCM, a block of samples
+// whose size depends on the rate (256 bytes per 11025 Hz, as other encoders do)
+size_t output_block_align(void);
+size_t output_block_align(void)
+{
+    switch (output_format) {
+        case SF_PCM24:  return 3;
+        case SF_FLOAT:  return 4;
+        case SF_ULAW:
+        case SF_ALAW:   return 1;
+        case SF_ADPCM:  return 256 * (sample_rate < 22050 ? 1 : sample_rate / 11025);
+        case SF_PCM16:
+        default:        return 2;
+    }
+}
+
+// number of samples in one block of output format
+size_t output_block_samples(void);
+size_t output_block_samples(void)
+{
+    return output_format == SF_ADPCM ? ima_adpcm_block_samples(output_block_align()) : 1;
+}
+
+// size of .wav file data holding given number of samples; last ADPCM block is padded
+uint64_t output_data_size(uint64_t samples);
+uint64_t output_data_size(uint64_t samples)
+{
+    uint64_t block_samples = output_block_samples();
+    return (samples + block_samples - 1) / block_samples * output_block_align();
+}
+
+// "fmt " chunk is extended for formats other than PCM, which also have a "fact" chunk
+size_t format_chunk_length(void);
+size_t format_chunk_length(void)
+{
+    switch (output_format) {
+        case SF_FLOAT:
+        case SF_ULAW:
+        case SF_ALAW:   return 18;
+        case SF_ADPCM:  return 20;
+        default:        return 16;
+    }
+}
+
+bool has_fact_chunk(void);
+bool has_fact_chunk(void)
+{
+    return format_chunk_length() > 16;
+}
+
+// size of .wav header for current format, with or without ds64 chunk
+size_t wave_header_length(bool ds64);
+size_t wave_header_length(bool ds64)
+{
+    return RIFF_HEADER_SIZE + (ds64 ? DS64_CHUNK_SIZE : 0) + 8 + format_chunk_length() +
+        (has_fact_chunk() ? 12 : 0) + 8;
+}
+
+#define MAX_WAVE_HEADER_SIZE (RIFF_HEADER_SIZE + DS64_CHUNK_SIZE + 8 + 20 + 12 + 8)
+
+// little-endian header fields
+uint8_t *put_id(uint8_t *p, const char *id);
+uint8_t *put_id(uint8_t *p, const char *id)
+{
+    memcpy(p, id, 4);
+    return p + 4;
+}
 
-// fill .wav file header area with zeroes
-SoundError begin_wave_file(FILE *file)
+uint8_t *put_uint(uint8_t *p, uint64_t value, int bytes);
+uint8_t *put_uint(uint8_t *p, uint64_t value, int bytes)
+{
+    for (int k = 0; k < bytes; k++) *p++ = (uint8_t)(value >> (8 * k));
+    return p;
+}
+
+// true if .wav file sizes fit in RIFF header; 0xFFFFFFFF is reserved to mean "see ds64 chunk"
+bool fits_riff(uint64_t data_size, size_t header_size);
+bool fits_riff(uint64_t data_size, size_t header_size)
+{
+    return data_size + header_size - 8 < UINT32_MAX;
+}
+
+// build .wav header of given size for current format: if the size has room for a ds64 chunk, it
+// is a RIFF header with a JUNK chunk if sizes fit in 32 bits, else an RF64 header; if size is
+// unknown, sizes are the "unknown size" values. Returns length of header.
+size_t build_wave_header(uint8_t *buffer, uint64_t data_size, uint64_t sample_count,
+                         size_t header_size, bool unknown);
+size_t build_wave_header(uint8_t *buffer, uint64_t data_size, uint64_t sample_count,
+                         size_t header_size, bool unknown)
+{
+    uint8_t *p = buffer;
+    uint64_t riff_size = data_size + header_size - 8;
+    bool fits = unknown || fits_riff(data_size, header_size);
+    size_t block_align = output_block_align();
+    size_t block_samples = output_block_samples();
+
+    if (unknown) {
+        riff_size = UNKNOWN_RIFF_SIZE;
+        data_size = UNKNOWN_RIFF_SIZE - (header_size - 8);
+    }
+
+    p = put_id(p, fits ? "RIFF" : "RF64");
+    p = put_uint(p, fits ? riff_size : UINT32_MAX, 4);
+    p = put_id(p, "WAVE");
+
+    if (header_size > wave_header_length(false)) {
+        // ds64 chunk goes between "WAVE" and "fmt " chunk
+        p = put_id(p, fits ? "JUNK" : "ds64");
+        p = put_uint(p, DS64_CHUNK_SIZE - 8, 4);
+        p = put_uint(p, fits ? 0 : riff_size, 8);
+        p = put_uint(p, fits ? 0 : data_size, 8);
+        p = put_uint(p, fits ? 0 : sample_count, 8);
+        p = put_uint(p, 0, 4);
+    }
+
+    p = put_id(p, "fmt ");
+    p = put_uint(p, format_chunk_length(), 4);
+    p = put_uint(p, output_format_tag(), 2);
+    p = put_uint(p, CHANNELS, 2);
+    p = put_uint(p, sample_rate, 4);
+    p = put_uint(p, (uint64_t)sample_rate * block_align * CHANNELS / block_samples, 4);
+    p = put_uint(p, block_align * CHANNELS, 2);
+    p = put_uint(p, output_format == SF_ADPCM ? 4 : 8 * block_align, 2);
+
+    if (output_format == SF_ADPCM) {
+        p = put_uint(p, 2, 2);
+        p = put_uint(p, block_samples, 2);
+
+    } else if (format_chunk_length() > 16) {
+        p = put_uint(p, 0, 2);
+    }
+
+    if (has_fact_chunk()) {
+        p = put_id(p, "fact");
+        p = put_uint(p, 4, 4);
+        p = put_uint(p, sample_count < UINT32_MAX ? sample_count : UINT32_MAX, 4);
+    }
+
+    p = put_id(p, "data");
+    p = put_uint(p, fits ? data_size : UINT32_MAX, 4);
+
+    return (size_t)(p - buffer);
+}
+
+// write .wav header of given size (see build_wave_header())
+SoundError put_wave_header(FILE *file, uint64_t data_size, uint64_t sample_count,
+                           size_t header_size, bool unknown);
+SoundError put_wave_header(FILE *file, uint64_t data_size, uint64_t sample_count,
+                           size_t header_size, bool unknown)
 {
     SoundError error = SE_NO_ERROR;
-    uint8_t header[WAVE_HEADER_SIZE];
+    uint8_t header[MAX_WAVE_HEADER_SIZE];
 
-    memset(header, 0, WAVE_HEADER_SIZE);
-    fwrite(&header, WAVE_HEADER_SIZE, 1, file);
+    // without room for ds64 chunk, sizes must fit in 32 bits
+    if (!unknown && header_size == wave_header_length(false) && !fits_riff(data_size, header_size)) {
+        error = SE_FILE_WRITE_ERROR;
+    }
+
+    if (error == SE_NO_ERROR) {
+        size_t length = build_wave_header(header, data_size, sample_count, header_size, unknown);
+        if (1 != fwrite(header, length, 1, file)) error = SE_FILE_WRITE_ERROR;
+    }
 
     return error;
 }
 
-#define CHANNELS 1
-#define BITS_PER_SAMPLE 16
+// map .wav file of known size into memory; if it can't be mapped, it's written with stdio
+void map_wave_file(FILE *file, uint64_t size);
+void map_wave_file(FILE *file, uint64_t size)
+{
+    int fd = fileno(file);
+
+    if (size <= SIZE_MAX && fflush(file) == 0 && ftruncate(fd, (off_t)size) == 0) {
+        void *map = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (map != MAP_FAILED) {
+            // samples are written once, front to back
+            madvise(map, (size_t)size, MADV_SEQUENTIAL);
+            wave_map = map;
+            wave_map_size = (size_t)size;
+
+        } else {
+            ftruncate(fd, 0);
+        }
+    }
+}
+
+// unmap .wav file, leaving it at the size written so far, positioned at its end
+SoundError unmap_wave_file(FILE *file);
+SoundError unmap_wave_file(FILE *file)
+{
+    SoundError error = SE_NO_ERROR;
+    off_t size = (off_t)(wave_header_size + wave_data_size);
+
+    if (munmap(wave_map, wave_map_size) != 0) error = SE_FILE_WRITE_ERROR;
+    wave_map = NULL;
+    wave_map_size = 0;
+
+    if (ftruncate(fileno(file), size) != 0 || fseeko(file, size, SEEK_SET) != 0) {
+        error = SE_FILE_WRITE_ERROR;
+    }
+
+    return error;
+}
+
+// space for size bytes of .wav file data, in mapped file or in writer thread's block; data written
+// there is committed by output_advance()
+uint8_t *output_space(size_t size);
+uint8_t *output_space(size_t size)
+{
+    return wave_map != NULL ? wave_map + wave_header_size + wave_data_size : writer_space(size);
+}
+
+void output_advance(size_t size);
+void output_advance(size_t size)
+{
+    if (wave_map == NULL) writer_advance(size);
+    wave_data_size += size;
+}
+
+// write .wav file header, if not yet written: zeroes to be filled in by finish_wave_file() for a
+// regular file, or the final header for a stream
+SoundError write_wave_header(FILE *file);
+SoundError write_wave_header(FILE *file)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (wave_header_pending) {
+        // count is no good if device changed the rate (native rate) since counting
+        bool known = wave_count_known && wave_count_rate == sample_rate;
+        uint64_t data_size = output_data_size(wave_count);
+
+        if (raw_output) {
+            wave_header_size = 0;
+
+        } else {
+            wave_header_size = wave_header_length(!known ||
+                                                  !fits_riff(data_size, wave_header_length(false)));
+        }
+
+        if (wave_seekable && known) map_wave_file(file, wave_header_size + data_size);
+
+        if (raw_output || wave_map != NULL) {
+            // no header, or header area of mapped file is already zeroes
+
+        } else if (wave_seekable) {
+            uint8_t zeroes[MAX_WAVE_HEADER_SIZE];
+            memset(zeroes, 0, sizeof(zeroes));
+            if (1 != fwrite(zeroes, wave_header_size, 1, file)) error = SE_FILE_WRITE_ERROR;
+
+        } else if (known) {
+            error = put_wave_header(file, data_size, wave_count, wave_header_size, false);
+
+        } else {
+            wave_header_size = wave_header_length(false);
+            error = put_wave_header(file, 0, 0, wave_header_size, true);
+        }
+    }
+
+    wave_header_pending = false;
+
+    return error;
+}
+
+// encode samples as IMA ADPCM blocks; a partial block is kept until more samples are added, or
+// until it is padded with silence by finish_wave_file()
+void encode_adpcm(const int16_t *samples, size_t count);
+void encode_adpcm(const int16_t *samples, size_t count)
+{
+    size_t block_align = output_block_align();
+    size_t block_samples = output_block_samples();
+
+    while (count > 0) {
+        size_t part = block_samples - adpcm_fill;
+        if (part > count) part = count;
+
+        memcpy(adpcm_block + adpcm_fill, samples, part * sizeof(int16_t));
+        adpcm_fill += part;
+        samples += part;
+        count -= part;
+
+        if (adpcm_fill == block_samples) {
+            int16_to_ima_adpcm(adpcm_block, output_space(block_align), block_align, &adpcm_index);
+            output_advance(block_align);
+            adpcm_fill = 0;
+        }
+    }
+}
 
 // fill in .wav file header area
 SoundError finish_wave_file(FILE *file)
 {
     SoundError error = SE_NO_ERROR;
-    WaveHeader header;
 
-    long offset = ftell(file);
-
-    memcpy(header.label, "RIFF", 4);
-    header.file_size_minus_8 = (uint32_t)offset - 8;
-    memcpy(header.file_type, "WAVE", 4);
-    memcpy(header.marker, "fmt ", 4);
-    header.length_so_far = 16;
-    header.format_type = 1;
-    header.channels = CHANNELS;
-    header.samples_per_second = SAMPLES_PER_SECOND;
-    header.bytes_per_second = (SAMPLES_PER_SECOND * BITS_PER_SAMPLE * CHANNELS) / 8;
-    header.bytes_per_sample = (BITS_PER_SAMPLE * CHANNELS) / 8;
-    header.bits_per_sample_per_channel = 16;
-    memcpy(header.data_header, "data", 4);
-    header.data_size = (uint32_t)offset - WAVE_HEADER_SIZE;
-
-    // overwrite header area at beginning
-    fseek(file, 0L, SEEK_SET);
-    fwrite(&header, sizeof(header), 1, file);
-
-    // go back to end of file
-    fseek(file, offset, SEEK_SET);
+    if (tone_file == file) {
+        error = flush_resampled(file);
+        tone_file = NULL;
+    }
+
+    if (error == SE_NO_ERROR) error = write_wave_header(file);
+
+    if (error == SE_NO_ERROR && adpcm_fill > 0) {
+        int16_t silence[BUF_SIZE];
+        size_t padding = output_block_samples() - adpcm_fill;
+
+        memset(silence, 0, sizeof(silence));
+        while (padding > 0) {
+            size_t count = padding < BUF_SIZE ? padding : BUF_SIZE;
+            encode_adpcm(silence, count);
+            padding -= count;
+        }
+    }
+
+    // wait for remaining data to be written, even after an error
+    SoundError writer_error = stop_writer();
+    if (error == SE_NO_ERROR) error = writer_error;
+
+    if (error == SE_NO_ERROR && wave_map != NULL) error = unmap_wave_file(file);
+
+    if (error == SE_NO_ERROR && wave_seekable && !raw_output) {
+        // overwrite header area at beginning
+        fseek(file, 0L, SEEK_SET);
+        error = put_wave_header(file, wave_data_size, wave_sample_count, wave_header_size, false);
+
+        // go back to end of file
+        fseek(file, 0L, SEEK_END);
+    }
 
     // caller must close file!
 
     return error;
 }
 
-#define BUF_SIZE 4096
+// Silence in a linear format is all zero bytes (and is not dithered). A mapped file is already
+// zeroes; in another regular file, silence of at least MIN_HOLE_SIZE bytes is left as a hole, which
+// takes no space on file systems that support sparse files. Shorter silences, and silences in
+// streams, are written.
+#define MIN_HOLE_SIZE 32768
+
+void put_silence(size_t count);
+void put_silence(size_t count)
+{
+    size_t sample_size = output_block_align();
+    uint64_t size = (uint64_t)count * sample_size;
+
+    if (wave_map != NULL) {
+        wave_data_size += size;
+
+    } else if (wave_seekable && size >= MIN_HOLE_SIZE) {
+        writer_skip(size);
+        wave_data_size += size;
+
+    } else {
+        while (count > 0) {
+            size_t block = count < BUF_SIZE ? count : BUF_SIZE;
+
+            memset(output_space(block * sample_size), 0, block * sample_size);
+            output_advance(block * sample_size);
+            count -= block;
+        }
+    }
+}
+
+// render up to BUF_SIZE samples of tone (or silence, if freq is 0) in the output format, which must
+// not be ADPCM (its blocks span calls)
+void encode_tone(uint8_t *out, double freq, size_t ramp, size_t total, size_t index, size_t count);
+void encode_tone(uint8_t *out, double freq, size_t ramp, size_t total, size_t index, size_t count)
+{
+    int16_t buffer[BUF_SIZE];
+    float float_buffer[BUF_SIZE];
+
+    switch (output_format) {
+        case SF_PCM16:
+        case SF_PCM24:
+        case SF_FLOAT:
+            if (freq == 0.0) {
+                // silence is not dithered
+                memset(out, 0, count * output_block_align());
+
+            } else if (output_format == SF_PCM16 && !use_dither) {
+                write_data((short *)out, freq, ramp, total, index, count);
+
+            } else if (output_format == SF_FLOAT) {
+                write_float_data((float *)out, freq, ramp, total, index, count);
+
+            } else {
+                write_float_data(float_buffer, freq, ramp, total, index, count);
+
+                if (output_format == SF_PCM24) {
+                    float_to_int24(float_buffer, out, count);
+
+                } else {
+                    float_to_int16(float_buffer, (int16_t *)out, count, use_dither);
+                }
+            }
+            break;
+
+        case SF_ULAW:
+        case SF_ALAW:
+            write_data(buffer, freq, ramp, total, index, count);
+
+            if (output_format == SF_ULAW) {
+                int16_to_ulaw(buffer, out, count);
+
+            } else {
+                int16_to_alaw(buffer, out, count);
+            }
+            break;
+
+        case SF_ADPCM:
+            break;
+    }
+}
 
 // write .wav file data
 SoundError fill_file(double freq, double msec, FILE *file)
@@ -370,47 +2211,401 @@ SoundError fill_file(double freq, double msec, FILE *file)
     fprintf(stderr, "fill_file(%f, %f)\n", freq, msec);
 #endif
 
-    SoundError error = SE_NO_ERROR;
+    SoundError error = write_wave_header(file);
 
-    size_t total = (size_t)(0.001 * msec * SAMPLES_PER_SECOND);
+    // also silence between resampled tones (see fill_resampled()), which is at sample_rate
+    size_t total = (size_t)(0.001 * msec * sample_rate);
     size_t remaining = total;
     double max_ramp_msec = msec * 0.30;
     double ramp_msec = RAMP_MSEC < max_ramp_msec ? RAMP_MSEC : max_ramp_msec;
-    size_t ramp = (size_t)(0.001 * ramp_msec * SAMPLES_PER_SECOND);
+    size_t ramp = (size_t)(0.001 * ramp_msec * sample_rate);
     size_t index = 0;
 
     int16_t buffer[BUF_SIZE];
+    size_t sample_size = output_block_align();
 
 #if DEBUG
     fprintf(stderr, "  total = %ld\n", (long)total);
 #endif
 
+    // if count was off and samples don't fit in mapped file, write the rest with stdio
+    if (wave_map != NULL &&
+        wave_header_size + output_data_size(wave_sample_count + total) > wave_map_size) {
+        error = unmap_wave_file(file);
+    }
+
+    if (error == SE_NO_ERROR && wave_map == NULL && !writer_running()) error = start_writer(file);
+
+    if (error == SE_NO_ERROR && freq == 0.0 && output_is_linear()) {
+        put_silence(total);
+        wave_sample_count += total;
+        remaining = 0;
+    }
+
     while (remaining > 0 && error == SE_NO_ERROR) {
         size_t count = remaining < BUF_SIZE ? remaining : BUF_SIZE;
 
-        write_data(buffer, freq, ramp, total, index, count);
-        fwrite(buffer, sizeof(int16_t), count, file);
-#if DEBUG
-        fprintf(stderr, "  fwrite %ld\n", (long)count);
-#endif
+        switch (output_format) {
+            case SF_PCM16:
+            case SF_PCM24:
+            case SF_FLOAT:
+                encode_tone(output_space(count * sample_size), freq, ramp, total, index, count);
+                output_advance(count * sample_size);
+                break;
+
+            case SF_ULAW:
+            case SF_ALAW:
+                encode_tone(output_space(count), freq, ramp, total, index, count);
+                output_advance(count);
+                break;
+
+            // ADPCM is encoded from 16-bit samples
+            case SF_ADPCM:
+                write_data(buffer, freq, ramp, total, index, count);
+                encode_adpcm(buffer, count);
+                break;
+        }
 
+        wave_sample_count += count;
         index += count;
         remaining -= count;
     }
 
+    if (error == SE_NO_ERROR && writer_running()) error = writer_status();
+
     return error;
 }
 
-// write fragment of sample data into buffer
-void write_data(short *data_ptr, double freq, size_t ramp_count, size_t total_count,
-                size_t start_index, size_t sample_count)
+// write floating-point samples (such as resampled tones) to .wav file
+SoundError write_file_samples(const float *samples, size_t count, FILE *file)
+{
+    SoundError error = write_wave_header(file);
+
+    int16_t buffer[BUF_SIZE];
+    size_t sample_size = output_block_align();
+
+    // if count was off and samples don't fit in mapped file, write the rest with stdio
+    if (wave_map != NULL &&
+        wave_header_size + output_data_size(wave_sample_count + count) > wave_map_size) {
+        error = unmap_wave_file(file);
+    }
+
+    if (error == SE_NO_ERROR && wave_map == NULL && !writer_running()) error = start_writer(file);
+
+    while (count > 0 && error == SE_NO_ERROR) {
+        size_t block = count < BUF_SIZE ? count : BUF_SIZE;
+
+        switch (output_format) {
+            case SF_PCM16:
+                float_to_int16(samples, (int16_t *)output_space(block * sample_size), block, use_dither);
+                output_advance(block * sample_size);
+                break;
+
+            case SF_PCM24:
+                float_to_int24(samples, output_space(block * sample_size), block);
+                output_advance(block * sample_size);
+                break;
+
+            case SF_FLOAT:
+                memcpy(output_space(block * sample_size), samples, block * sizeof(float));
+                output_advance(block * sample_size);
+                break;
+
+            case SF_ULAW:
+            case SF_ALAW:
+                float_to_int16(samples, buffer, block, false);
+
+                if (output_format == SF_ULAW) {
+                    int16_to_ulaw(buffer, output_space(block), block);
+
+                } else {
+                    int16_to_alaw(buffer, output_space(block), block);
+                }
+
+                output_advance(block);
+                break;
+
+            case SF_ADPCM:
+                float_to_int16(samples, buffer, block, false);
+                encode_adpcm(buffer, block);
+                break;
+        }
+
+        wave_sample_count += block;
+        samples += block;
+        count -= block;
+    }
+
+    if (error == SE_NO_ERROR && writer_running()) error = writer_status();
+
+    return error;
+}
+
+// longest tone and gap rendered once by fill_repeated(); longer periods are synthesized each time
+#define MAX_PERIOD_SECONDS 10
+
+// number of samples from index to the end of the tone, or of the gap, up to BUF_SIZE
+size_t period_block(size_t index, size_t tone_count, size_t count);
+size_t period_block(size_t index, size_t tone_count, size_t count)
+{
+    size_t end = index < tone_count ? tone_count : count;
+
+    return end - index < BUF_SIZE ? end - index : BUF_SIZE;
+}
+
+// Tone followed by gap, repeated. One period is rendered, then copied for each repeat: for a file,
+// in the output format, except that dithered tones are kept as floating-point samples (dither
+// differs on each repeat) and ADPCM as 16-bit samples (its blocks span periods); for the device, as
+// 16-bit samples copied into the buffers. Gaps in linear formats and on the device aren't rendered,
+// but go the same way as other silences. Resampled tones are done one at a time, and their gaps
+// are passed over by the resampler (see fill_resampled()).
+SoundError fill_repeated(double freq, double msec, double gap, int repeats, FILE *file)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (tone_recorder != NULL) return tone_recorder(freq, msec, gap, repeats, true);
+
+    size_t tone_count = msec_to_samples(msec);
+    size_t count = tone_count + msec_to_samples(gap);
+    size_t rendered = file == NULL || output_is_linear() ? tone_count : count;
+    bool dithered = file != NULL && output_format == SF_PCM16 && use_dither;
+    bool encoded = file != NULL && output_format != SF_ADPCM && !dithered;
+    size_t sample_size = encoded ? output_block_align() : dithered ? sizeof(float) : sizeof(int16_t);
+    uint8_t *period = NULL;
+
+    // counted and resampled tones, tones for a background stream, and tones played by toggling a
+    // GPIO pin, are done one at a time
+    bool render = repeats > 1 && rendered > 0 && !counting_samples && !tones_resampled() &&
+                  count <= (size_t)MAX_PERIOD_SECONDS * sample_rate;
+    if (file == NULL && current_stream > 0) render = false;
+#ifdef GPIO
+    if (file == NULL) render = false;
+#endif
+
+    if (render) period = (uint8_t *)malloc(rendered * sample_size);
+
+    if (period == NULL) {
+        for (int k = 0; k < repeats && error == SE_NO_ERROR; k++) {
+            error = fill_buffer_or_file(freq, msec, file);
+            if (error == SE_NO_ERROR) error = fill_buffer_or_file(SILENCE, gap, file);
+        }
+
+    } else {
+        double max_ramp_msec = msec * 0.30;
+        double ramp_msec = RAMP_MSEC < max_ramp_msec ? RAMP_MSEC : max_ramp_msec;
+        size_t ramp = (size_t)(0.001 * ramp_msec * sample_rate);
+        size_t block;
+
+        for (size_t index = 0; index < rendered; index += block) {
+            double block_freq = index < tone_count ? freq : SILENCE;
+            uint8_t *out = period + index * sample_size;
+
+            block = period_block(index, tone_count, rendered);
+
+            if (encoded) {
+                encode_tone(out, block_freq, ramp, tone_count, index, block);
+
+            } else if (dithered) {
+                write_float_data((float *)out, block_freq, ramp, tone_count, index, block);
+
+            } else {
+                write_data((short *)out, block_freq, ramp, tone_count, index, block);
+            }
+        }
+
+        if (file != NULL) {
+            error = write_wave_header(file);
+
+            // if count was off and samples don't fit in mapped file, write the rest with stdio
+            if (wave_map != NULL && wave_header_size +
+                output_data_size(wave_sample_count + (uint64_t)repeats * count) > wave_map_size) {
+                error = unmap_wave_file(file);
+            }
+
+            if (error == SE_NO_ERROR && wave_map == NULL && !writer_running()) error = start_writer(file);
+        }
+
+        for (int k = 0; k < repeats && error == SE_NO_ERROR; k++) {
+            if (file == NULL) {
+                count_submitted(msec, tone_count);
+                error = buffer_samples((const int16_t *)period, tone_count);
+                if (error == SE_NO_ERROR) error = fill_buffer(SILENCE, gap);
+
+            } else {
+                for (size_t index = 0; index < rendered; index += block) {
+                    block = period_block(index, tone_count, rendered);
+
+                    if (encoded) {
+                        memcpy(output_space(block * sample_size), period + index * sample_size,
+                               block * sample_size);
+                        output_advance(block * sample_size);
+
+                    } else if (dithered) {
+                        float_to_int16((const float *)period + index,
+                                       (int16_t *)output_space(block * sizeof(int16_t)), block, true);
+                        output_advance(block * sizeof(int16_t));
+
+                    } else {
+                        encode_adpcm((const int16_t *)period + index, block);
+                    }
+                }
+
+                if (rendered < count) put_silence(count - rendered);
+
+                wave_sample_count += count;
+                if (writer_running()) error = writer_status();
+            }
+        }
+
+        free(period);
+    }
+
+    return error;
+}
+
+// Fixed-point synthesis, for processors without fast floating point (e.g. Raspberry Pi Zero):
+// phase is a 64-bit accumulator (2^64 = one cycle), sine and ramp envelope come from a Q30 table of
+// one cycle with linear interpolation. The frequency is converted once to Q32 Hz, and the increment
+// is its integer ratio to the rate in Q64 cycles, so the phase at sample k is exactly k times the
+// increment (modulo 2^64), and rounding does not accumulate over long tones. Samples are within 1
+// of the floating-point samples written by write_data().
+#define SINE_TABLE_BITS 10
+#define SINE_TABLE_SIZE (1 << SINE_TABLE_BITS)
+#define SINE_FRACTION_BITS 15
+#define QUARTER_CYCLE ((uint64_t)1 << 30)
+
+#ifdef FIXED_POINT
+bool use_fixed_point = true;
+#else
+bool use_fixed_point = false;
+#endif
+
+int32_t sine_table[SINE_TABLE_SIZE + 1];
+bool sine_table_OK = false;
+
+// select fixed-point (true) or floating-point (false) synthesis
+void set_fixed_point(bool enabled)
+{
+    use_fixed_point = enabled;
+}
+
+void get_sound_settings(SoundSettings *settings)
+{
+    settings->output_format = output_format;
+    settings->dither = use_dither;
+    settings->raw_output = raw_output;
+    settings->fixed_point = use_fixed_point;
+    settings->resample_quality = resample_quality;
+    settings->wave_count_known = wave_count_known;
+    settings->stream = current_stream;
+}
+
+void set_sound_settings(const SoundSettings *settings)
+{
+    output_format = settings->output_format;
+    use_dither = settings->dither;
+    raw_output = settings->raw_output;
+    use_fixed_point = settings->fixed_point;
+    resample_quality = settings->resample_quality;
+    wave_count_known = settings->wave_count_known;
+    current_stream = settings->stream;
+}
+
+void init_sine_table(void);
+void init_sine_table(void)
+{
+    for (int k = 0; k <= SINE_TABLE_SIZE; k++) {
+        sine_table[k] = (int32_t)lround(sin(2.0 * M_PI * k / SINE_TABLE_SIZE) * (1L << 30));
+    }
+
+    sine_table_OK = true;
+}
+
+// sine of phase (2^32 = one cycle), Q30
+int32_t fixed_sine(uint32_t phase);
+int32_t fixed_sine(uint32_t phase)
+{
+    uint32_t index = phase >> (32 - SINE_TABLE_BITS);
+    int32_t fraction = (int32_t)((phase >> (32 - SINE_TABLE_BITS - SINE_FRACTION_BITS)) &
+                                 ((1 << SINE_FRACTION_BITS) - 1));
+    int32_t a = sine_table[index];
+    int32_t b = sine_table[index + 1];
+
+    return a + (int32_t)(((int64_t)(b - a) * fraction) >> SINE_FRACTION_BITS);
+}
+
+// fixed-point version of synthesize_data()
+void write_fixed_data(short *data_ptr, double freq, size_t ramp_count, size_t total_count,
+                      size_t start_index, size_t sample_count);
+void write_fixed_data(short *data_ptr, double freq, size_t ramp_count, size_t total_count,
+                      size_t start_index, size_t sample_count)
+{
+    if (!sine_table_OK) init_sine_table();
+
+    // Q64 cycles per sample = (Q32 Hz << 32) / rate, in two steps so as not to overflow
+    uint64_t freq_q32 = (uint64_t)llround(freq * 4294967296.0);
+    uint64_t rate = tone_rate();
+    uint64_t increment = ((freq_q32 / rate) << 32) + ((freq_q32 % rate) << 32) / rate;
+    uint64_t phase = (uint64_t)start_index * increment;
+
+    // ramp envelope is first quarter cycle of sine; increment per sample is Q16
+    uint64_t ramp_increment = ramp_count > 0 ? (QUARTER_CYCLE << 16) / ramp_count : 0;
+
+    for (size_t k = start_index; k < start_index + sample_count; k++) {
+        int64_t amplitude = fixed_sine((uint32_t)(phase >> 32));
+
+        if (k < ramp_count) {
+            amplitude = (amplitude * fixed_sine((uint32_t)((k * ramp_increment) >> 16))) >> 30;
+
+        } else if (k > total_count - ramp_count) {
+            amplitude = (amplitude * fixed_sine((uint32_t)(((total_count - k) * ramp_increment) >> 16))) >> 30;
+        }
+
+        // scale to 16 bits, truncating toward zero like (short) conversion of double
+        amplitude *= 32767;
+        *data_ptr++ = (short)(amplitude >= 0 ? amplitude >> 30 : -((-amplitude) >> 30));
+
+        phase += increment;
+    }
+}
+
+// write fragment of sample data into floating-point buffer
+void write_float_data(float *data_ptr, double freq, size_t ramp_count, size_t total_count,
+                      size_t start_index, size_t sample_count)
+{
+    double rate = tone_rate();
+
+    for (size_t k = start_index; k < start_index + sample_count; k++) {
+        double theta = 2.0 * M_PI * freq * k / rate;
+        double amplitude = sin(theta) * FLOAT_AMPLITUDE;
+        if (k < ramp_count) {
+            amplitude *= sin(0.5 * M_PI * k / ramp_count);
+
+        } else if (k > total_count - ramp_count) {
+            amplitude *= sin(0.5 * M_PI * (total_count - k) / ramp_count);
+        }
+
+        *data_ptr++ = (float)amplitude;
+    }
+}
+
+// synthesize fragment of sample data into buffer
+void synthesize_data(short *data_ptr, double freq, size_t ramp_count, size_t total_count,
+                     size_t start_index, size_t sample_count);
+void synthesize_data(short *data_ptr, double freq, size_t ramp_count, size_t total_count,
+                     size_t start_index, size_t sample_count)
 {
     if (freq == 0.0) {
         memset(data_ptr, 0, sample_count * sizeof(short));
 
+    } else if (use_fixed_point) {
+        write_fixed_data(data_ptr, freq, ramp_count, total_count, start_index, sample_count);
+
     } else {
+        double rate = tone_rate();
+
         for (size_t k = start_index; k < start_index + sample_count; k++) {
-            double theta = 2.0 * M_PI * freq * k / SAMPLES_PER_SECOND;
+            double theta = 2.0 * M_PI * freq * k / rate;
             double amplitude = sin(theta) * 32767;
             if (k < ramp_count) {
                 amplitude *= sin(0.5 * M_PI * k / ramp_count);
@@ -424,61 +2619,63 @@ void write_data(short *data_ptr, double freq, size_t ramp_count, size_t total_co
     }
 }
 
-// start playing data in buffers
-SoundError play_buffers(void)
+// render whole tone for shared tone cache
+void render_cached_tone(int16_t *data, const ToneKey *key);
+void render_cached_tone(int16_t *data, const ToneKey *key)
 {
-    SoundError error = SE_NO_ERROR;
+    synthesize_data((short *)data, key->freq, (size_t)key->ramp_count, (size_t)key->total_count, 0,
+                    (size_t)key->total_count);
+}
 
-#ifndef GPIO
-    if (data_offset > 0) {
-        // current buffer is partially filled
-        alBufferData(buffers[current_buffer], AL_FORMAT_MONO16, data,
-                     (ALsizei)data_offset * sizeof(ALshort), SAMPLES_PER_SECOND);
+// write fragment of sample data into buffer, from the shared tone cache if one is attached
+#define MAX_CACHED_TONE_SAMPLES (1 << 18)
 
-        error = al_to_se_error(alGetError());
+void write_data(short *data_ptr, double freq, size_t ramp_count, size_t total_count,
+                size_t start_index, size_t sample_count)
+{
+    const int16_t *cached = NULL;
 
-        if (error == SE_NO_ERROR) {
-            alSourceQueueBuffers(source, 1, &buffers[current_buffer]);
-            buffer_queued[current_buffer] = true;
-            error = al_to_se_error(alGetError());
-        }
+    if (freq != 0.0 && total_count <= MAX_CACHED_TONE_SAMPLES) {
+        ToneKey key;
+
+        key.freq = freq;
+        key.total_count = total_count;
+        key.ramp_count = ramp_count;
+        key.rate = tone_rate();
+        key.fixed_point = use_fixed_point;
+        cached = cached_tone(&key, render_cached_tone);
+    }
+
+    if (cached != NULL) {
+        memcpy(data_ptr, cached + start_index, sample_count * sizeof(short));
+
+    } else {
+        synthesize_data(data_ptr, freq, ramp_count, total_count, start_index, sample_count);
+    }
+}
 
-#if DEBUG
-        fprintf(stderr, "play_buffers queue %d\n", current_buffer);
-#endif
+// start playing data in buffers
+SoundError play_buffers(void)
+{
+    SoundError error = SE_NO_ERROR;
 
-        if (error == SE_NO_ERROR) {
-            ALint state;
-            alGetSourcei(source, AL_SOURCE_STATE, &state);
-            if (state != AL_PLAYING) {
-                // nothing is playing; either we haven't started yet, or we finished all
-                // queued buffers.
-
-                // make sure all except current buffer are unqueued
-                for (int k = 0; k < NUM_BUFFERS && error == SE_NO_ERROR; k++) {
-                    if (k != current_buffer && buffer_queued[k]) {
-                        alSourceUnqueueBuffers(source, 1, &buffers[k]);
-                        error = al_to_se_error(alGetError());
-#if DEBUG
-                        fprintf(stderr, "play_buffers unqueue non-playing %d\n", k);
-#endif
-                        buffer_queued[k] = false;
-                    }
-                }
+    // nothing is played while counting
+    if (counting_samples) return error;
 
-                if (error == SE_NO_ERROR) {
-                    alSourcePlay(source);
-                    error = al_to_se_error(alGetError());
-#if DEBUG
-                    fprintf(stderr, "play_buffers play\n");
-#endif
-                }
-            }
-        }
+    if (tone_file == NULL) error = flush_resampled(NULL);
 
-        current_buffer = (current_buffer + 1) % NUM_BUFFERS;
-        data_offset = 0;
+#ifdef ALSA
+    if (error == SE_NO_ERROR && pcm != NULL && snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED) {
+        // ring buffer is partially filled; start device if anything has been written
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        if (avail >= 0 && (snd_pcm_uframes_t)avail < ring_size) {
+            error = alsa_to_se_error(snd_pcm_start(pcm));
+        }
     }
+
+#elif !defined(GPIO)
+    // current buffer is partially filled
+    if (error == SE_NO_ERROR && data_offset > 0) error = queue_current_buffer(data, data_offset, sample_rate);
 #endif
 
     return error;
@@ -486,7 +2683,10 @@ SoundError play_buffers(void)
 
 bool sound_playing(void)
 {
-#ifndef GPIO
+#ifdef ALSA
+    return pcm != NULL && snd_pcm_state(pcm) == SND_PCM_STATE_RUNNING;
+
+#elif !defined(GPIO)
 
     ALint value;
     
@@ -510,17 +2710,42 @@ SoundError wait_for_buffers(void)
 #if DEBUG
     fprintf(stderr, "wait_for_buffers()\n");
 #endif
-    
-#ifndef GPIO
-    bool done = false;
+
+    if (counting_samples) return error;
+
+    error = check_preemption();
+
+#ifdef ALSA
+    // if playing can be preempted, wait until only one period is left to play, checking as we go
+    while (error == SE_NO_ERROR && pcm != NULL && preempt_check != NULL &&
+           snd_pcm_state(pcm) == SND_PCM_STATE_RUNNING) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        if (avail < 0 || (snd_pcm_uframes_t)avail + period_size >= ring_size) break;
+
+        error = advance_device();
+    }
+
+    if (error == SE_NO_ERROR && pcm != NULL) error = alsa_flush();
+
+    if (error == SE_NO_ERROR && pcm != NULL) {
+        // play everything written so far, then get ready for more
+        int result = snd_pcm_drain(pcm);
+        if (result >= 0) result = snd_pcm_prepare(pcm);
+        error = alsa_to_se_error(result);
+    }
+
+#elif !defined(GPIO)
+    // background streams play on while later options run (see wait_for_streams())
+    bool done = current_stream > 0;
     while (!done && error == SE_NO_ERROR) {
         ALint value;
         alGetSourcei(source, AL_SOURCE_STATE, &value);
         error = al_to_se_error(alGetError());
         done = value != AL_PLAYING;
+        if (!done) error = advance_device();
     }
     
-    for (int k = 0; k < NUM_BUFFERS && error == SE_NO_ERROR; k++) {
+    for (int k = 0; k < NUM_BUFFERS && error == SE_NO_ERROR && current_stream == 0; k++) {
         if (buffer_queued[k]) {
             alSourceUnqueueBuffers(source, 1, &buffers[k]);
             error = al_to_se_error(alGetError());
@@ -540,9 +2765,107 @@ SoundError wait_for_buffers(void)
     return error;
 }
 
+// play tones on stream (0 is the main stream; others are mixed with it, and play on while later
+// options run); what has been given to the main stream starts playing first
+SoundError select_stream(int stream)
+{
+    SoundError error = SE_NO_ERROR;
+
+#if defined(GPIO) || defined(ALSA)
+    if (stream != 0) error = SE_INVALID_OPTION;
+
+#else
+    if (stream < 0 || stream >= MAX_STREAMS) error = SE_INVALID_VALUE;
+    if (error == SE_NO_ERROR && current_stream == 0 && stream != 0) error = play_buffers();
+#endif
+
+    if (error == SE_NO_ERROR) current_stream = stream;
+
+    return error;
+}
+
+// stop background stream now, discarding what it has left to play
+SoundError stop_stream(int stream)
+{
+#if defined(GPIO) || defined(ALSA)
+    (void)stream;
+    return SE_INVALID_OPTION;
+
+#else
+    if (stream < 1 || stream >= MAX_STREAMS) return SE_INVALID_VALUE;
+
+    if (!counting_samples) stop_background_stream(&streams[stream]);
+
+    return SE_NO_ERROR;
+#endif
+}
+
+// wait until main and background streams have played everything given to them
+SoundError wait_for_streams(void)
+{
+    SoundError error = SE_NO_ERROR;
+
+#if !defined(GPIO) && !defined(ALSA)
+    bool opened = false;
+    for (int k = 1; k < MAX_STREAMS; k++) {
+        if (streams[k].OK) opened = true;
+    }
+
+    if (opened && !counting_samples) {
+        int stream = current_stream;
+
+        current_stream = 0;
+        error = play_buffers();
+        if (error == SE_NO_ERROR) error = wait_for_buffers();
+        current_stream = stream;
+
+        bool busy = true;
+        while (busy && error == SE_NO_ERROR) {
+            // what the streams have left, however short, is played now
+            error = pump_streams(true);
+
+            busy = false;
+            for (int k = 1; k < MAX_STREAMS; k++) {
+                if (stream_busy(&streams[k])) busy = true;
+            }
+
+            if (busy) error = advance_device();
+        }
+    }
+#endif
+
+    return error;
+}
+
 void close_sound(void)
 {
-#ifndef GPIO
+    delete_resampler(tone_resampler);
+    tone_resampler = NULL;
+    free(resampled_tone);
+    resampled_tone = NULL;
+
+#ifdef ALSA
+    if (pcm != NULL) {
+        snd_pcm_close(pcm);
+        pcm = NULL;
+    }
+
+    if (data != NULL) {
+        free(data);
+        data = NULL;
+    }
+
+    delete_resampler(pcm_resampler);
+    pcm_resampler = NULL;
+    free(pcm_input);
+    free(pcm_output);
+    free(pcm_converted);
+    pcm_input = NULL;
+    pcm_output = NULL;
+    pcm_converted = NULL;
+    pcm_input_rate = 0;
+
+#elif !defined(GPIO)
     if (data != NULL) {
         free(data);
         data = NULL;
@@ -558,6 +2881,8 @@ void close_sound(void)
         buffers_OK = false;
     }
 
+    close_streams();
+
     if (context != NULL) {
         alcMakeContextCurrent(NULL);
         alcDestroyContext(context);
@@ -580,23 +2905,19 @@ SoundError play_wav(const char *path)
     
 #else
     WaveHeader header;
-    int16_t *file_data = NULL;
-    long file_size;
+    WaveData data;
     
-    SoundError error = read_wav(path, &header, &file_data, &file_size);
+    SoundError error = read_wav(path, &header, &data);
 
 #if DEBUG
-            fprintf(stderr, "wav file size %ld\n", file_size);
+            fprintf(stderr, "wav data size %llu\n", (unsigned long long)data.size);
 #endif
 
-    if (error == SE_NO_ERROR) error = play_wav_data(&header, file_data, file_size);
+    if (error == SE_NO_ERROR) error = play_wav_data(&header, data.frames, data.size);
     
     if (error == SE_NO_ERROR) error = wait_for_buffers();
     
-    if (file_data != NULL) {
-        free(file_data);
-        file_data = NULL;
-    }
+    close_wav(&data);
 
 #if DEBUG
     if (error != SE_NO_ERROR) fprintf(stderr, "play_wav() = %s\n", sound_error_text(error));
@@ -606,56 +2927,247 @@ SoundError play_wav(const char *path)
 #endif
 }
 
-SoundError read_wav(const char *path, WaveHeader *header, int16_t **file_data, long *file_size)
+void close_wav(WaveData *data)
+{
+    if (data->map != NULL) munmap(data->map, data->map_size);
+    free(data->buffer);
+
+    memset(data, 0, sizeof(WaveData));
+}
+
+// read whole file into newly allocated buffer, for files that can't be mapped (such as pipes)
+SoundError read_to_end(FILE *file, uint8_t **bytes, size_t *size);
+SoundError read_to_end(FILE *file, uint8_t **bytes, size_t *size)
+{
+    SoundError error = SE_NO_ERROR;
+    size_t capacity = 0;
+    bool done = false;
+
+    *size = 0;
+
+    while (!done && error == SE_NO_ERROR) {
+        if (*size == capacity) {
+            size_t new_capacity = capacity == 0 ? 1 << 20 : 2 * capacity;
+            uint8_t *new_bytes = new_capacity > capacity ? realloc(*bytes, new_capacity) : NULL;
+
+            if (new_bytes == NULL) {
+                error = SE_OUT_OF_MEMORY;
+
+            } else {
+                *bytes = new_bytes;
+                capacity = new_capacity;
+            }
+        }
+
+        if (error == SE_NO_ERROR) {
+            size_t count = fread(*bytes + *size, 1, capacity - *size, file);
+            *size += count;
+            done = *size < capacity;
+        }
+    }
+
+    if (error == SE_NO_ERROR && ferror(file) != 0) error = SE_FILE_READ_ERROR;
+
+    return error;
+}
+
+// map file into memory, or read it if it can't be mapped; data->map or data->buffer holds the bytes
+SoundError map_wav_file(FILE *file, WaveData *data, const uint8_t **bytes, size_t *size);
+SoundError map_wav_file(FILE *file, WaveData *data, const uint8_t **bytes, size_t *size)
+{
+    SoundError error = SE_NO_ERROR;
+    struct stat status;
+
+    if (0 == fstat(fileno(file), &status) && S_ISREG(status.st_mode) && status.st_size > 0 &&
+        (uint64_t)status.st_size <= SIZE_MAX) {
+        void *map = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+
+        if (map != MAP_FAILED) {
+            // pages are read ahead as the player works through the file
+            madvise(map, (size_t)status.st_size, MADV_SEQUENTIAL);
+
+            data->map = map;
+            data->map_size = (size_t)status.st_size;
+        }
+    }
+
+    if (data->map != NULL) {
+        *bytes = data->map;
+        *size = data->map_size;
+
+    } else {
+        uint8_t *buffer = NULL;
+        error = read_to_end(file, &buffer, size);
+        data->buffer = buffer;
+        *bytes = buffer;
+    }
+
+    return error;
+}
+
+// decode compressed .wav file data to 16-bit samples in newly allocated buffer, changing header to
+// match; fact_samples, if not 0, is the number of samples without padding
+SoundError decode_wav_data(WaveHeader *header, const uint8_t *in, uint64_t data_size,
+                           uint64_t fact_samples, int16_t **samples, uint64_t *samples_size);
+SoundError decode_wav_data(WaveHeader *header, const uint8_t *in, uint64_t data_size,
+                           uint64_t fact_samples, int16_t **samples, uint64_t *samples_size)
+{
+    SoundError error = SE_NO_ERROR;
+    size_t block_align = header->bytes_per_sample;
+    size_t blocks = (size_t)(data_size / block_align);
+    size_t block_samples = header->format_type == WAVE_FORMAT_IMA_ADPCM ?
+        ima_adpcm_block_samples(block_align) : 1;
+    size_t count = blocks * block_samples;
+
+    if (fact_samples > 0 && fact_samples < count) count = (size_t)fact_samples;
+
+    *samples = (int16_t *)malloc(blocks * block_samples * sizeof(int16_t) + 1);
+    if (*samples == NULL) error = SE_OUT_OF_MEMORY;
+
+    if (error == SE_NO_ERROR) {
+        switch (header->format_type) {
+            case WAVE_FORMAT_MULAW:
+                ulaw_to_int16(in, *samples, count);
+                break;
+
+            case WAVE_FORMAT_ALAW:
+                alaw_to_int16(in, *samples, count);
+                break;
+
+            case WAVE_FORMAT_IMA_ADPCM:
+                for (size_t k = 0; k < blocks; k++) {
+                    ima_adpcm_to_int16(in + k * block_align, *samples + k * block_samples, block_align);
+                }
+                break;
+        }
+
+        *samples_size = count * sizeof(int16_t);
+
+        header->format_type = WAVE_FORMAT_PCM;
+        header->bytes_per_sample = sizeof(int16_t);
+        header->bits_per_sample_per_channel = 16;
+        header->bytes_per_second = header->samples_per_second * sizeof(int16_t);
+    }
+
+    return error;
+}
+
+// read .wav file: RIFF, or RF64 with 64-bit sizes in a ds64 chunk; chunks other than "fmt ", "fact"
+// and "data" (such as "LIST") are skipped. The file is mapped into memory, and integer and float
+// data, with any number of channels, is used in place, so playing starts without reading the whole
+// file. mu-law, A-law and IMA ADPCM data is decoded to 16-bit samples. Caller must release data
+// with close_wav().
+SoundError read_wav(const char *path, WaveHeader *header, WaveData *data)
 {
+    memset(data, 0, sizeof(WaveData));
+
 #ifdef GPIO
     return SE_INVALID_OPTION;
     
 #else
     SoundError error = SE_NO_ERROR;
     FILE *file = fopen(path, "r");
-    *file_data = NULL;
+    const uint8_t *bytes = NULL;
+    size_t size = 0;
+    size_t offset = RIFF_HEADER_SIZE;
+    bool rf64 = false;
+    bool found_format = false;
+    bool found_data = false;
+    uint64_t ds64_data_size = 0;
+    uint64_t fact_samples = 0;
+    uint64_t data_size = 0;
+
+    memset(header, 0, sizeof(WaveHeader));
     
     if (file == NULL) error = SE_INPUT_FILE_OPEN_ERROR;
+
+    if (error == SE_NO_ERROR) error = map_wav_file(file, data, &bytes, &size);
+
+    // mapping stays valid after file is closed
+    if (file != NULL) fclose(file);
     
     if (error == SE_NO_ERROR) {
-        fseek(file, 0L, SEEK_END);
-        *file_size = ftell(file);
-        rewind(file);
-
-        if (*file_size < (long)sizeof(WaveHeader)) error = SE_INVALID_FILE_FORMAT;
+        if (size < RIFF_HEADER_SIZE) error = SE_INVALID_FILE_FORMAT;
     }
-    
+
     if (error == SE_NO_ERROR) {
-        if (1 != fread(header, sizeof(WaveHeader), 1, file)) error = SE_FILE_READ_ERROR;
+        memcpy(header, bytes, RIFF_HEADER_SIZE);
+        rf64 = 0 == strncmp(header->label, "RF64", 4);
+
+        bool ok = rf64 || 0 == strncmp(header->label, "RIFF", 4);
+        ok = ok && 0 == strncmp(header->file_type, "WAVE", 4);
+
+        if (!ok) error = SE_INVALID_FILE_FORMAT;
     }
-    
+
+    // find format and start of data
+    while (error == SE_NO_ERROR && !found_data) {
+        const uint8_t *chunk = bytes + offset;
+        uint32_t chunk_size = 0;
+
+        if (size - offset < 8) {
+            error = SE_INVALID_FILE_FORMAT;
+
+        } else {
+            memcpy(&chunk_size, chunk + 4, sizeof(chunk_size));
+            offset += 8;
+        }
+
+        if (error != SE_NO_ERROR) {
+            // no more chunks
+
+        } else if (0 == strncmp((const char *)chunk, "data", 4)) {
+            memcpy(header->data_header, chunk, 4);
+            header->data_size = chunk_size;
+            found_data = true;
+
+        } else if (chunk_size > size - offset) {
+            error = SE_INVALID_FILE_FORMAT;
+
+        } else if (0 == strncmp((const char *)chunk, "ds64", 4) && chunk_size >= 24) {
+            // RIFF size, data size, sample count
+            memcpy(&ds64_data_size, chunk + 8 + 8, sizeof(ds64_data_size));
+
+        } else if (0 == strncmp((const char *)chunk, "fmt ", 4) && chunk_size >= 16) {
+            // format_type through bits_per_sample_per_channel
+            memcpy(header->marker, chunk, 4);
+            header->length_so_far = chunk_size;
+            memcpy(&header->format_type, chunk + 8, 16);
+            found_format = true;
+
+            if (header->format_type == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 40) {
+                // actual format is first two bytes of subformat GUID
+                memcpy(&header->format_type, chunk + 8 + 24, sizeof(header->format_type));
+            }
+
+        } else if (0 == strncmp((const char *)chunk, "fact", 4) && chunk_size >= 4) {
+            // number of samples, for compressed formats
+            uint32_t samples;
+            memcpy(&samples, chunk + 8, sizeof(samples));
+            fact_samples = samples;
+        }
+
+        // chunks are padded to even size
+        if (error == SE_NO_ERROR && !found_data) {
+            offset += chunk_size;
+            if (offset < size) offset += chunk_size & 1;
+        }
+    }
+
     if (error == SE_NO_ERROR) {
-        if (header->file_size_minus_8 == 2147483684) {
-            fprintf(stderr, "patching file sizes\n");
-            
-            header->file_size_minus_8 = (uint32_t)*file_size - 8;
-            header->data_size = (uint32_t)*file_size - sizeof(WaveHeader);
+        if (header->file_size_minus_8 == UNKNOWN_RIFF_SIZE) {
+            // written to a stream; data continues to end of file
+            data_size = size - offset;
+            fact_samples = 0;
+
+        } else if (rf64 && header->data_size == UINT32_MAX) {
+            data_size = ds64_data_size;
+
+        } else {
+            data_size = header->data_size;
         }
         
 #if DEBUG
-        /*
-        struct WaveHeader {
-            char label[4];
-            uint32_t file_size_minus_8;
-            char file_type[4];
-            char marker[4];
-            uint32_t length_so_far;
-            uint16_t format_type;
-            uint16_t channels;
-            uint32_t samples_per_second;
-            uint32_t bytes_per_second;
-            uint16_t bytes_per_sample;
-            uint16_t bits_per_sample_per_channel;
-            char data_header[4];
-            uint32_t data_size;
-        };
-        */
         fprintf(stderr, "Header for %s\n", path);
         fprintf(stderr, "label = %c%c%c%c\n", header->label[0], header->label[1], header->label[2], header->label[3]);
         fprintf(stderr, "file_size_minus_8 = %u\n", header->file_size_minus_8);
@@ -669,36 +3181,52 @@ SoundError read_wav(const char *path, WaveHeader *header, int16_t **file_data, l
         fprintf(stderr, "bytes_per_sample = %d\n", (int)header->bytes_per_sample);
         fprintf(stderr, "bits_per_sample_per_channel = %d\n", (int)header->bits_per_sample_per_channel);
         fprintf(stderr, "data_header = %c%c%c%c\n", header->data_header[0], header->data_header[1], header->data_header[2], header->data_header[3]);
-        fprintf(stderr, "data_size = %u\n", header->data_size);
+        fprintf(stderr, "data_size = %u (%llu)\n", header->data_size, (unsigned long long)data_size);
+        fprintf(stderr, "data_offset = %lu (%s)\n", (unsigned long)offset, data->map != NULL ? "mapped" : "read");
 
 #endif
         
-        bool ok = 0 == strncmp(header->label, "RIFF", 4);
-        ok = ok && 0 == strncmp(header->file_type, "WAVE", 4);
-        ok = ok && 0 == strncmp(header->marker, "fmt ", 4);
-        ok = ok && 1 == header->format_type;
-        ok = ok && 1 == header->channels;
+        unsigned int bits = header->bits_per_sample_per_channel;
+        bool pcm = WAVE_FORMAT_PCM == header->format_type && (8 == bits || 16 == bits || 24 == bits || 32 == bits);
+        bool ieee_float = WAVE_FORMAT_IEEE_FLOAT == header->format_type && (32 == bits || 64 == bits);
+        bool linear = (pcm || ieee_float) && header->channels <= MAX_FRAME_CHANNELS &&
+            header->bytes_per_sample == header->channels * bits / 8;
+        bool g711 = (WAVE_FORMAT_MULAW == header->format_type || WAVE_FORMAT_ALAW == header->format_type) &&
+            1 == header->bytes_per_sample && 1 == header->channels;
+        bool adpcm = WAVE_FORMAT_IMA_ADPCM == header->format_type && 4 == bits &&
+            header->bytes_per_sample > 4 && 1 == header->channels;
+
+        bool ok = found_format;
+        ok = ok && (linear || g711 || adpcm);
+        ok = ok && header->channels > 0;
+        ok = ok && header->samples_per_second > 0;
 //        ok = ok && SAMPLES_PER_SECOND == header->samples_per_second;
-        ok = ok && 2 == header->bytes_per_sample;
-        ok = ok && 1 == header->channels;
-        ok = ok && 0 == strncmp(header->data_header, "data", 4);
-        ok = ok && (long long)*file_size >= (long long)sizeof(WaveHeader) + (long long)header->data_size;
+        ok = ok && data_size <= size - offset;
 
         if (!ok) error = SE_INVALID_FILE_FORMAT;
     }
-    
-    if (error == SE_NO_ERROR) {
-        *file_data = (int16_t *)malloc((size_t)header->data_size);
-        if (*file_data == NULL) error = SE_OUT_OF_MEMORY;
-    }
-    
-    if (error == SE_NO_ERROR) {
-        if (header->data_size != fread(*file_data, 1, header->data_size, file)) {
-            error = SE_FILE_READ_ERROR;
+
+    if (error == SE_NO_ERROR && (header->format_type == WAVE_FORMAT_PCM ||
+                                 header->format_type == WAVE_FORMAT_IEEE_FLOAT)) {
+        // use frames in place; they are converted as they are played
+        data->frames = bytes + offset;
+        data->size = data_size;
+
+    } else if (error == SE_NO_ERROR) {
+        int16_t *samples = NULL;
+        uint64_t samples_size = 0;
+
+        error = decode_wav_data(header, bytes + offset, data_size, fact_samples, &samples, &samples_size);
+
+        if (error == SE_NO_ERROR) {
+            close_wav(data);
+            data->buffer = samples;
+            data->frames = samples;
+            data->size = samples_size;
         }
     }
-     
-    if (file != NULL) fclose(file);
+
+    if (error != SE_NO_ERROR) close_wav(data);
 
 #if DEBUG
     if (error != SE_NO_ERROR) fprintf(stderr, "read_wav() = %s\n", sound_error_text(error));
@@ -708,98 +3236,141 @@ SoundError read_wav(const char *path, WaveHeader *header, int16_t **file_data, l
 #endif
 }
 
-SoundError play_wav_data(WaveHeader *header, int16_t *file_data, long file_size)
+// true if .wav frames can be played without conversion: 16-bit mono, aligned for 16-bit samples
+bool wav_frames_native(const WaveHeader *header, const void *frames);
+bool wav_frames_native(const WaveHeader *header, const void *frames)
+{
+    return header->format_type == WAVE_FORMAT_PCM && header->bits_per_sample_per_channel == 16 &&
+        header->channels == 1 && ((uintptr_t)frames & 1) == 0;
+}
+
+// convert count .wav frames starting at index to 16-bit mono
+void convert_wav_frames(const WaveHeader *header, const void *frames, size_t index, size_t count,
+                        int16_t *out);
+void convert_wav_frames(const WaveHeader *header, const void *frames, size_t index, size_t count,
+                        int16_t *out)
+{
+    frames_to_int16((const uint8_t *)frames + index * header->bytes_per_sample, out, count, header->channels,
+                    header->bits_per_sample_per_channel, header->format_type == WAVE_FORMAT_IEEE_FLOAT);
+}
+
+// convert count .wav frames starting at index to floating-point mono
+void convert_wav_frames_float(const WaveHeader *header, const void *frames, size_t index, size_t count,
+                              float *out);
+void convert_wav_frames_float(const WaveHeader *header, const void *frames, size_t index, size_t count,
+                              float *out)
+{
+    frames_to_float((const uint8_t *)frames + index * header->bytes_per_sample, out, count, header->channels,
+                    header->bits_per_sample_per_channel, header->format_type == WAVE_FORMAT_IEEE_FLOAT);
+}
+
+// play window of 16-bit samples at rate
+SoundError play_window(const int16_t *samples, size_t count, unsigned int rate);
+SoundError play_window(const int16_t *samples, size_t count, unsigned int rate)
+{
+#ifdef ALSA
+    (void)rate;
+    return alsa_play(samples, 0.0, 0, 0, 0, count);
+
+#elif !defined(GPIO)
+    SoundError error = wait_for_current_buffer();
+    if (error == SE_NO_ERROR) error = queue_current_buffer(samples, count, rate);
+
+    return error;
+
+#else
+    return SE_INVALID_OPTION;
+#endif
+}
+
+// play .wav frames a window (BUFFER_SECONDS) at a time, converting each window to 16-bit mono and
+// resampling it to sample_rate if necessary. With OpenAL, the file is played through the buffer
+// ring, so only NUM_BUFFERS windows are held by OpenAL at a time, however long the file is.
+SoundError play_wav_data(WaveHeader *header, const void *frames, uint64_t data_size)
 {
 #ifdef GPIO
     return SE_INVALID_OPTION;
     
 #else
-    
-#if 0
-    SoundError error = SE_NO_ERROR;
+    // total - total number of frames
+    // window - frames converted at a time
+    // capacity - samples played at a time
+    size_t total = (size_t)(data_size / header->bytes_per_sample);
+    size_t window = BUFFER_SECONDS * header->samples_per_second;
+    size_t capacity = window;
+    unsigned int file_rate = header->samples_per_second;
+    bool resampling = file_rate != sample_rate && resample_quality != RQ_DEVICE;
+    unsigned int rate = resampling ? sample_rate : file_rate;
+    bool native = !resampling && wav_frames_native(header, frames);
+    Resampler *resampler = NULL;
+    float *input = NULL;
+    float *output = NULL;
+    int16_t *converted = NULL;
+
+    // end of resampled tones goes before file
+    SoundError error = tone_file == NULL ? flush_resampled(NULL) : SE_NO_ERROR;
+
+#ifdef ALSA
+    // if file isn't resampled here, let the plug layer resample it if necessary
+    if (error == SE_NO_ERROR && rate != pcm_input_rate) error = alsa_set_rate(rate, !resampling);
 
-    while (buffer_queued[current_buffer] && error == SE_NO_ERROR) {
-        // if current buffer is already queued, then they are all queued; need to wait to until
-        // current buffer (which is the oldest queued buffer) is done, so we can start
-        // filling it again
-        ALint processed = 0;
-        while (processed == 0 && error == SE_NO_ERROR) {
-            alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
-            error = al_to_se_error(alGetError());
-        }
+#else
+    if (error == SE_NO_ERROR) error = wait_for_buffers();
 
-        if (error == SE_NO_ERROR) {
-            alSourceUnqueueBuffers(source, 1, &buffers[current_buffer]);
-            error = al_to_se_error(alGetError());
-#if DEBUG
-            fprintf(stderr, "[%d] unqueue %d\n", processed, current_buffer);
+    // device resamples file to sample_rate
+    if (error == SE_NO_ERROR) {
+        count_submitted(1000.0 * total / file_rate, (size_t)((uint64_t)total * sample_rate / file_rate));
+    }
 #endif
-        }
 
-        if (error == SE_NO_ERROR) {
-            alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
-#if DEBUG
-            fprintf(stderr, "[%d]\n", processed);
-#endif
-            buffer_queued[current_buffer] = false;
-        }
+    if (error == SE_NO_ERROR && resampling) {
+        resampler = new_resampler(file_rate, sample_rate, resample_quality);
+        if (resampler != NULL) capacity = resample_capacity(resampler, window);
+
+        input = (float *)malloc(window * sizeof(float));
+        output = (float *)malloc(capacity * sizeof(float));
+
+        if (resampler == NULL || input == NULL || output == NULL) error = SE_OUT_OF_MEMORY;
     }
-#else
-    SoundError error = wait_for_buffers();
-#endif
 
-    if (error == SE_NO_ERROR) {
-        // total - total number of samples
-        size_t total = header->data_size / header->bytes_per_sample;
+    if (error == SE_NO_ERROR && !native) {
+        converted = (int16_t *)malloc(capacity * sizeof(int16_t));
+        if (converted == NULL) error = SE_OUT_OF_MEMORY;
+    }
 
-        // write entire file data into buffer
-        alBufferData(buffers[current_buffer], AL_FORMAT_MONO16, file_data,
-                     (ALsizei)total * sizeof(ALshort), header->samples_per_second);
+    for (size_t index = 0; index < total && error == SE_NO_ERROR; index += window) {
+        size_t count = total - index < window ? total - index : window;
+        const int16_t *source = converted;
 
-        error = al_to_se_error(alGetError());
-#if DEBUG
-        fprintf(stderr, "queue %d\n", current_buffer);
-#endif
+        if (native) {
+            source = (const int16_t *)frames + index;
 
-        if (error == SE_NO_ERROR) {
-            // queue buffer
-            alSourceQueueBuffers(source, 1, &buffers[current_buffer]);
-            buffer_queued[current_buffer] = true;
-            error = al_to_se_error(alGetError());
+        } else if (resampling) {
+            convert_wav_frames_float(header, frames, index, count, input);
+            count = resample(resampler, input, count, output);
+            float_to_int16(output, converted, count, false);
+
+        } else {
+            convert_wav_frames(header, frames, index, count, converted);
         }
 
-        if (error == SE_NO_ERROR) {
-            ALint state;
-            alGetSourcei(source, AL_SOURCE_STATE, &state);
-            if (state != AL_PLAYING) {
-                // nothing is playing; either we haven't started yet, or we finished all
-                // queued buffers.
-
-                // make sure all except current buffer are unqueued
-                for (int k = 0; k < NUM_BUFFERS && error == SE_NO_ERROR; k++) {
-                    if (k != current_buffer && buffer_queued[k]) {
-                        alSourceUnqueueBuffers(source, 1, &buffers[k]);
-                        error = al_to_se_error(alGetError());
-#if DEBUG
-                        fprintf(stderr, "unqueue non-playing %d\n", k);
-#endif
-                        buffer_queued[k] = false;
-                    }
-                }
+        if (count > 0) error = play_window(source, count, rate);
+    }
 
-                if (error == SE_NO_ERROR) {
-                    alSourcePlay(source);
-#if DEBUG
-                    fprintf(stderr, "play\n");
+    if (error == SE_NO_ERROR && resampling) {
+        size_t count = resample_flush(resampler, output);
+        float_to_int16(output, converted, count, false);
+        if (count > 0) error = play_window(converted, count, rate);
+    }
+
+#ifdef ALSA
+    if (error == SE_NO_ERROR) error = play_buffers();
 #endif
-                    error = al_to_se_error(alGetError());
-                }
-            }
-        }
 
-        current_buffer = (current_buffer + 1) % NUM_BUFFERS;
-        data_offset = 0;
-    }
+    delete_resampler(resampler);
+    free(input);
+    free(output);
+    free(converted);
 
 #if DEBUG
     if (error != SE_NO_ERROR) fprintf(stderr, "play_wav_data() = %s\n", sound_error_text(error));
@@ -837,6 +3408,10 @@ const char *sound_error_text(SoundError error)
         case SE_FILE_ALREADY_OPEN_ERROR:    return "SE_FILE_ALREADY_OPEN_ERROR";    break;
         case SE_FILE_WRITE_ERROR:           return "SE_FILE_WRITE_ERROR";           break;
         case SE_INVALID_FILE_FORMAT:        return "SE_INVALID_FILE_FORMAT";        break;
+        case SE_INVALID_RATE:               return "SE_INVALID_RATE";               break;
+        case SE_SOCKET_ERROR:               return "SE_SOCKET_ERROR";               break;
+        case SE_PREEMPTED:                  return "SE_PREEMPTED";                  break;
+        case SE_BUSY:                       return "SE_BUSY";                       break;
         default:                            return "SE_UNKNOWN";                    break;
     }
 }
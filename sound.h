@@ -58,9 +58,29 @@ typedef enum SoundError {
     SE_OUTPUT_FILE_OPEN_ERROR,
     SE_FILE_ALREADY_OPEN_ERROR,
     SE_FILE_WRITE_ERROR,
-    SE_INVALID_FILE_FORMAT
+    SE_INVALID_FILE_FORMAT,
+    SE_INVALID_RATE,
+    SE_SOCKET_ERROR,
+    SE_PREEMPTED,
+    SE_BUSY
 } SoundError;
 
+typedef enum SampleFormat {
+    SF_PCM16 = 0,
+    SF_PCM24,
+    SF_FLOAT,
+    SF_ULAW,
+    SF_ALAW,
+    SF_ADPCM
+} SampleFormat;
+
+typedef enum ResampleQuality {
+    RQ_DEVICE = 0,      // leave resampling of .wav files to device
+    RQ_FAST,
+    RQ_MEDIUM,
+    RQ_BEST
+} ResampleQuality;
+
 struct WaveHeader {
     char label[4];
     uint32_t file_size_minus_8;
@@ -78,24 +98,79 @@ struct WaveHeader {
 };
 typedef struct WaveHeader WaveHeader;
 
+// frames read by read_wav(), in the format given by the header; they point into a read-only
+// mapping of the file, or, for compressed data or a file that can't be mapped, into a buffer.
+// Release with close_wav().
+struct WaveData {
+    const void *frames;
+    uint64_t size;          // size of frames in bytes
+    void *map;              // mapping of file, or NULL
+    size_t map_size;
+    void *buffer;           // allocated buffer, or NULL
+};
+typedef struct WaveData WaveData;
+
+// settings that options may change between tones; saved and restored around daemon requests, so
+// that one request doesn't change the next
+struct SoundSettings {
+    SampleFormat output_format;
+    bool dither;
+    bool raw_output;
+    bool fixed_point;
+    ResampleQuality resample_quality;
+    bool wave_count_known;
+    int stream;
+};
+typedef struct SoundSettings SoundSettings;
+
+// called while waiting for the device; returning true stops what is playing, with a short fade,
+// and the function that was playing it, and any that play after it, return SE_PREEMPTED
+typedef bool (*PreemptCheck)(void);
+
+// called with each tone or gap instead of rendering it; repeated is true for fill_repeated(), which
+// gives gap and repeats
+typedef SoundError (*ToneRecorder)(double freq, double msec, double gap, int repeats, bool repeated);
+
+void set_sound_device(const char *name);
+SoundError set_sample_rate(unsigned int rate);
+SoundError set_synth_rate(unsigned int rate);
+void set_resample_quality(ResampleQuality quality);
+SoundError set_loopback(bool enabled);
+void set_fixed_point(bool enabled);
+void get_sound_settings(SoundSettings *settings);
+void set_sound_settings(const SoundSettings *settings);
+void set_preempt_check(PreemptCheck check);
+void set_tone_recorder(ToneRecorder recorder);
+void print_loopback_statistics(FILE *file);
 SoundError init_sound(void);
 SoundError fill_buffer_or_file(double freq, double msec, FILE *file);
+SoundError fill_repeated(double freq, double msec, double gap, int repeats, FILE *file);
 SoundError fill_file(double freq, double msec, FILE *file);
 SoundError fill_buffer(double freq, double msec);
 
 SoundError play_buffers(void);
 bool sound_playing(void);
 SoundError wait_for_buffers(void);
+SoundError select_stream(int stream);
+SoundError stop_stream(int stream);
+SoundError wait_for_streams(void);
 void close_sound(void);
 
 bool sound_playing(void);
 
+SoundError set_output_format(SampleFormat format);
+void set_dither(bool enabled);
+void set_raw_output(bool enabled);
+void set_wave_sample_count(uint64_t count);
+void begin_sample_count(void);
+uint64_t end_sample_count(void);
 SoundError begin_wave_file(FILE *file);
 SoundError finish_wave_file(FILE *file);
 
 SoundError play_wav(const char *path);
-SoundError read_wav(const char *path, WaveHeader *header, int16_t **file_data, long *file_size);
-SoundError play_wav_data(WaveHeader *header, int16_t *file_data, long file_size);
+SoundError read_wav(const char *path, WaveHeader *header, WaveData *data);
+void close_wav(WaveData *data);
+SoundError play_wav_data(WaveHeader *header, const void *frames, uint64_t data_size);
 
 const char *sound_error_text(SoundError error);
 
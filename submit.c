@@ -0,0 +1,389 @@
+//
+// submit.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// for pipe() and fcntl()
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "patterns.h"
+#include "submit.h"
+
+// passed on to play() and play_code() as it is
+#if SUBMIT_DEFAULT_FREQ != DEFAULT
+#error "SUBMIT_DEFAULT_FREQ must be the same as DEFAULT"
+#endif
+
+// The queue is an intrusive multiple-producer, single-consumer linked list (after Dmitry Vyukov's):
+// a producer swaps its node in as the newest with one atomic exchange, then links the previous
+// newest to it, so no producer ever waits for another. Nodes come from a fixed pool, handed out in
+// turn by an atomic counter; a producer whose node hasn't been played since it was last used (so
+// about SUBMIT_POOL_SIZE requests are waiting) gets SE_BUSY instead of waiting. When the queue is
+// empty, the player sleeps on a pipe, and a producer writes to the pipe only if the player is
+// asleep. Atomic operations are GCC/Clang builtins, as the rest of mbeep is C99.
+#define SUBMIT_POOL_SIZE 64
+
+typedef enum SubmissionKind {
+    SK_TONE = 0,
+    SK_CODE,
+    SK_MIDI
+} SubmissionKind;
+
+typedef struct Submission Submission;
+
+struct Submission {
+    Submission *next;       // next newer node in queue
+    bool used;              // taken by a producer, and not yet played
+    SubmissionKind kind;
+    double freq;
+    double msec;
+    double gap;
+    int repeats;
+    double speed;           // words per minute for Morse code, beats per minute for MIDI notes
+    char text[MAX_SUBMITTED_TEXT];
+};
+
+Submission submit_pool[SUBMIT_POOL_SIZE];
+unsigned int submit_ticket = 0;
+
+// the queue always holds at least one node; the stub is put back in when it would be empty
+Submission submit_stub;
+Submission *submit_newest = &submit_stub;     // shared by producers
+Submission *submit_oldest = &submit_stub;     // used only by player
+
+pthread_t player_thread;
+bool player_started = false;
+bool player_sleeping = false;
+bool player_stopping = false;
+int player_pipe[2] = { -1, -1 };
+SoundError player_error = SE_NO_ERROR;
+
+// link node onto queue as its newest
+void push_submission(Submission *node);
+void push_submission(Submission *node)
+{
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    Submission *previous = __atomic_exchange_n(&submit_newest, node, __ATOMIC_SEQ_CST);
+
+    // until this store, the player sees the queue end at previous
+    __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+}
+
+// oldest submission in queue, or NULL if there is none (or one is being linked); player only
+Submission *take_submission(void);
+Submission *take_submission(void)
+{
+    Submission *taken = NULL;
+    Submission *oldest = submit_oldest;
+    Submission *next = __atomic_load_n(&oldest->next, __ATOMIC_ACQUIRE);
+
+    if (oldest == &submit_stub && next != NULL) {
+        submit_oldest = next;
+        oldest = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (oldest != &submit_stub) {
+        if (next == NULL && oldest == __atomic_load_n(&submit_newest, __ATOMIC_SEQ_CST)) {
+            // oldest is the only node; put the stub in behind it, so that it can be taken
+            push_submission(&submit_stub);
+            next = __atomic_load_n(&oldest->next, __ATOMIC_ACQUIRE);
+        }
+
+        if (next != NULL) {
+            submit_oldest = next;
+            taken = oldest;
+        }
+    }
+
+    return taken;
+}
+
+// true if the queue holds anything but the stub (including a node still being linked)
+bool submissions_waiting(void);
+bool submissions_waiting(void)
+{
+    return submit_oldest != &submit_stub || __atomic_load_n(&submit_newest, __ATOMIC_SEQ_CST) != &submit_stub;
+}
+
+// wake player if it is asleep
+void wake_player(void);
+void wake_player(void)
+{
+    if (__atomic_exchange_n(&player_sleeping, false, __ATOMIC_SEQ_CST)) {
+        char byte = 0;
+        ssize_t written = write(player_pipe[1], &byte, 1);
+        (void)written;
+    }
+}
+
+// sleep until a producer submits something, or player is stopped
+void wait_for_submission(void);
+void wait_for_submission(void)
+{
+    __atomic_store_n(&player_sleeping, true, __ATOMIC_SEQ_CST);
+
+    if (submissions_waiting()) {
+        // a producer is between its exchange and its link; it won't be long
+        sched_yield();
+
+    } else if (!__atomic_load_n(&player_stopping, __ATOMIC_SEQ_CST)) {
+        struct pollfd fds = { player_pipe[0], POLLIN, 0 };
+        while (poll(&fds, 1, -1) < 0 && errno == EINTR) {}
+    }
+
+    __atomic_store_n(&player_sleeping, false, __ATOMIC_SEQ_CST);
+
+    char bytes[64];
+    while (read(player_pipe[0], bytes, sizeof(bytes)) > 0) {}
+}
+
+SoundError play_submission(const Submission *submission);
+SoundError play_submission(const Submission *submission)
+{
+    SoundError error = SE_NO_ERROR;
+    int fcc_char_count = 0;
+
+    switch (submission->kind) {
+        case SK_TONE:
+            error = play(submission->freq, submission->msec, submission->gap, submission->repeats, NULL);
+            break;
+
+        case SK_CODE:
+            error = play_code(submission->freq, 1200.0 / submission->speed, true, 1.0, 0.0, &fcc_char_count,
+                              submission->text, NULL);
+            break;
+
+        case SK_MIDI:
+            error = play_midi(submission->speed, submission->gap, submission->text, NULL);
+            break;
+    }
+
+    // start playing now, without waiting for the buffer to fill
+    if (error == SE_NO_ERROR) error = play_buffers();
+
+    return error;
+}
+
+// player thread: play submissions in order until stopped and the queue is empty; keeps the first
+// error, and plays on
+void *play_submissions(void *arg);
+void *play_submissions(void *arg)
+{
+    bool done = false;
+
+    while (!done) {
+        Submission *submission = take_submission();
+
+        if (submission != NULL) {
+            SoundError error = play_submission(submission);
+            if (player_error == SE_NO_ERROR) player_error = error;
+
+            // node may be used again
+            __atomic_store_n(&submission->used, false, __ATOMIC_RELEASE);
+
+        } else if (__atomic_load_n(&player_stopping, __ATOMIC_SEQ_CST) && !submissions_waiting()) {
+            done = true;
+
+        } else {
+            wait_for_submission();
+        }
+    }
+
+    SoundError error = wait_for_buffers();
+    if (player_error == SE_NO_ERROR) player_error = error;
+
+    return NULL;
+}
+
+// open audio device, and start player thread
+SoundError start_player(void)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (player_started) error = SE_INVALID_OPERATION;
+
+    if (error == SE_NO_ERROR && pipe(player_pipe) != 0) error = SE_OUT_OF_MEMORY;
+
+    if (error == SE_NO_ERROR) {
+        fcntl(player_pipe[0], F_SETFL, fcntl(player_pipe[0], F_GETFL) | O_NONBLOCK);
+        fcntl(player_pipe[1], F_SETFL, fcntl(player_pipe[1], F_GETFL) | O_NONBLOCK);
+
+        error = init_sound();
+    }
+
+    if (error == SE_NO_ERROR) {
+        player_sleeping = false;
+        player_stopping = false;
+        player_error = SE_NO_ERROR;
+
+        if (pthread_create(&player_thread, NULL, play_submissions, NULL) != 0) {
+            close_sound();
+            error = SE_OUT_OF_MEMORY;
+        }
+    }
+
+    player_started = error == SE_NO_ERROR;
+
+    if (!player_started && player_pipe[0] >= 0) {
+        close(player_pipe[0]);
+        close(player_pipe[1]);
+        player_pipe[0] = player_pipe[1] = -1;
+    }
+
+    return error;
+}
+
+// node for a submission, or NULL if its slot in the pool is still waiting to be played
+Submission *new_submission(SubmissionKind kind);
+Submission *new_submission(SubmissionKind kind)
+{
+    unsigned int ticket = __atomic_fetch_add(&submit_ticket, 1, __ATOMIC_RELAXED);
+    Submission *node = &submit_pool[ticket % SUBMIT_POOL_SIZE];
+
+    if (__atomic_exchange_n(&node->used, true, __ATOMIC_ACQUIRE)) {
+        node = NULL;
+
+    } else {
+        node->kind = kind;
+    }
+
+    return node;
+}
+
+// queue node for player
+void submit(Submission *node);
+void submit(Submission *node)
+{
+    push_submission(node);
+    wake_player();
+}
+
+// play tone followed by gap, repeated; freq may be SUBMIT_DEFAULT_FREQ
+SoundError submit_tone(double freq, double msec, double gap, int repeats)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (freq != SUBMIT_DEFAULT_FREQ && (freq < 20.0 || freq > 20000.0)) error = SE_INVALID_FREQUENCY;
+    if (msec < 0.0) error = SE_INVALID_TIME;
+    if (gap < 0.0) error = SE_INVALID_GAP;
+    if (repeats < 0) error = SE_INVALID_REPEATS;
+
+    Submission *node = error == SE_NO_ERROR ? new_submission(SK_TONE) : NULL;
+    if (error == SE_NO_ERROR && node == NULL) error = SE_BUSY;
+
+    if (error == SE_NO_ERROR) {
+        node->freq = freq;
+        node->msec = msec;
+        node->gap = gap;
+        node->repeats = repeats;
+        submit(node);
+    }
+
+    return error;
+}
+
+// copy text of submission, which must be shorter than MAX_SUBMITTED_TEXT
+SoundError submit_text(SubmissionKind kind, double freq, double speed, double gap, const char *text);
+SoundError submit_text(SubmissionKind kind, double freq, double speed, double gap, const char *text)
+{
+    SoundError error = SE_NO_ERROR;
+    size_t length = strlen(text);
+
+    if (length >= MAX_SUBMITTED_TEXT) error = SE_INVALID_VALUE;
+
+    Submission *node = error == SE_NO_ERROR ? new_submission(kind) : NULL;
+    if (error == SE_NO_ERROR && node == NULL) error = SE_BUSY;
+
+    if (error == SE_NO_ERROR) {
+        node->freq = freq;
+        node->speed = speed;
+        node->gap = gap;
+        memcpy(node->text, text, length + 1);
+        submit(node);
+    }
+
+    return error;
+}
+
+// send text as Morse code at wpm (PARIS standard); freq may be SUBMIT_DEFAULT_FREQ
+SoundError submit_code(double freq, double wpm, const char *text)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (freq != SUBMIT_DEFAULT_FREQ && (freq < 20.0 || freq > 20000.0)) error = SE_INVALID_FREQUENCY;
+    if (wpm < 5.0 || wpm > 60.0) error = SE_INVALID_WPM;
+
+    if (error == SE_NO_ERROR) error = submit_text(SK_CODE, freq, wpm, 0.0, text);
+
+    return error;
+}
+
+// play MIDI notes (see mbeep --midi-help) at bpm quarter notes per minute
+SoundError submit_midi(double bpm, double gap, const char *text)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (bpm < 20.0 || bpm > 500.0) error = SE_INVALID_BPM;
+    if (gap < 0.0) error = SE_INVALID_GAP;
+
+    if (error == SE_NO_ERROR) error = submit_text(SK_MIDI, 0.0, bpm, gap, text);
+
+    return error;
+}
+
+// play what has been submitted so far, then stop player thread and close audio device; returns
+// first error of player
+SoundError stop_player(void)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (player_started) {
+        char byte = 0;
+
+        __atomic_store_n(&player_stopping, true, __ATOMIC_SEQ_CST);
+        ssize_t written = write(player_pipe[1], &byte, 1);
+        (void)written;
+
+        pthread_join(player_thread, NULL);
+        error = player_error;
+        close_sound();
+
+        close(player_pipe[0]);
+        close(player_pipe[1]);
+        player_pipe[0] = player_pipe[1] = -1;
+        player_started = false;
+    }
+
+    return error;
+}
@@ -0,0 +1,50 @@
+//
+// submit.h
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef submit_h
+#define submit_h
+
+#include "sound.h"
+
+// Submission of tones by a program that embeds mbeep (see libmbeep.a in the Makefile). Any number
+// of threads may submit tones, Morse code and MIDI notes; submitting copies the request into a
+// preallocated slot and links it onto a lock-free queue, so it is wait-free, and never waits for
+// audio. One player thread, started by start_player(), plays the requests in the order they were
+// submitted. While it runs, it is the only thread that may call the functions of sound.h; settings
+// such as set_sample_rate() are made before start_player().
+
+#define MAX_SUBMITTED_TEXT 256
+
+// freq of submit_tone() and submit_code() for the usual frequency (440 Hz for tones, 750 Hz for code)
+#define SUBMIT_DEFAULT_FREQ -1
+
+SoundError start_player(void);
+SoundError submit_tone(double freq, double msec, double gap, int repeats);
+SoundError submit_code(double freq, double wpm, const char *text);
+SoundError submit_midi(double bpm, double gap, const char *text);
+SoundError stop_player(void);
+
+#endif /* submit_h */
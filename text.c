@@ -46,6 +46,10 @@ void usage(void)
            "  mbeep [-o <output_file] [-b <beats_per_min>] -i <input_file> -m\n"
            "  mbeep [-o <output_file] [-w <words_per_min>] -c <string_to_send_as_morse_code>\n"
            "  mbeep [-o <output_file] [-w <words_per_min>] -i <input_file>  -c\n"
+           "  mbeep [--device <name>] [--rate <rate>] [--busy queue|drop] --daemon <socket>|-\n"
+           "  mbeep --client <socket> [--priority <n>] [<options>]\n"
+           "  mbeep [--window <msec>] [--limit <n>] [--burst <n>] --events <file>|-\n"
+           "  mbeep [--on <pattern> <options>]... --watch <file>\n"
            "  mbeep -h | --help\n"
            "  mbeep -v | --version\n"
            "  mbeep --midi-help\n"
@@ -59,8 +63,19 @@ void usage(void)
            "  -g <gap>          Gap between tones in msec [default: 50]\n"
            "  -r <repeats>      Number of times to repeat tone [default: 1]\n"
            "  -p                Play tone. Used when specifying sequence of multiple tones.\n"
+           "  --stream <n>      Play following tones on stream n (0-7), mixed with the others [default: 0]\n"
+           "  --stop-stream <n> Stop playing stream n (1-7) now\n"
            "  -o <output>       Write .wav file containing tones\n"
            "  --wav <output>    Write .wav file containing tones\n"
+           "  --raw             Write output file without .wav header\n"
+           "  --format <fmt>    Format of .wav file samples: pcm16, pcm24, float, ulaw, alaw, adpcm\n"
+           "                    [default: pcm16]\n"
+           "  --dither          Add TPDF dither to 16-bit .wav file samples\n"
+           "  --cache <dir>     Render once into cache directory, then copy or play from there\n"
+           "  --cache-size <mb> Size limit of cache in megabytes [default: 64]\n"
+           "  --tone-cache <name> Share rendered tones with other processes in shared memory segment\n"
+           "  --compile <file>  Write tones played after this to tone program file, instead of playing them\n"
+           "  --run <file>      Play tone program file written by --compile\n"
            "  -b <tempo>        Quarter notes per minute [default: 120]\n"
            "  -w <wpm>          Morse code speed in PARIS words per minute [default: 20]\n"
            "  --codex-wpm <wpm> Morse code speed in CODEX words per minute [default: 16 2/3]\n"
@@ -68,7 +83,25 @@ void usage(void)
            "  -x <speed>        Character speed for Farnsworth Morse code timing\n"
            "  --wss <speed>     Word speed with extra space between words\n"
            "  -i <input>        Input file or path for text used by -m or -c options\n"
-           "  --play <file>     Play .wav file written by mbeep (for testing)\n"
+           "  --play <file>     Play .wav file\n"
+           "  --fixed-point     Use fixed-point synthesis (for processors without fast FPU)\n"
+           "  --floating-point  Use floating-point synthesis\n"
+           "  --rate <rate>     Sample rate in Hz, or native for device's rate [default: 44100]\n"
+           "  --synth-rate <hz> Synthesize tones at this rate and resample to sample rate\n"
+           "  --resample <qual> Resampling quality: fast, medium, best, or device to leave\n"
+           "                    .wav files to the device [default: medium]\n"
+           "  --device <name>   Audio output device [default: system default device]\n"
+           "  --loopback        Play through loopback device and print statistics (for testing)\n"
+           "  --daemon <socket> Keep device open and run options sent by clients to socket (- for stdin lines)\n"
+           "  --busy <policy>   Daemon queues (queue) or drops (drop) requests while another is playing\n"
+           "  --client <socket> Send options to daemon instead of running them (first option)\n"
+           "  --priority <n>    Preempt daemon request of lower priority (first option after --client)\n"
+           "  --events <file>   Play lines of events (CLASS [<options>]) from file (- for stdin), with limits:\n"
+           "  --window <msec>   Play events of a class within msec of the first once, with count (default 1000)\n"
+           "  --limit <n>       Play each class of events at most n times per minute (default 12)\n"
+           "  --burst <n>       Number of plays of a class that can be saved up (default 3)\n"
+           "  --watch <file>    Follow file like tail -F, and play lines written to it (Linux):\n"
+           "  --on <pattern> <options>  Play options for lines that match regular expression\n"
            "  -I                Use stdin for text used by -m or -c options\n"
            "  -m <string>       Send sequence of MIDI notes specified by string\n"
            "  -m                Send sequence of MIDI notes specified by input file\n"
@@ -253,6 +286,10 @@ void man_page_source(void)
            "\\fBmbeep\\fR [\\fB\\-o\\fR \\fIFILE\\fR] [\\fB\\-b\\fR \\fIBPM\\fR] \\fB\\-i\\fR \\fIFILE\\fR \\fB\\-m\\fR\n"
            "\\fBmbeep\\fR [\\fB\\-o\\fR \\fIFILE\\fR] [\\fB\\-w\\fR \\fIWPM\\fR] [\\fB\\-x\\fR \\fICHAR_SPEED\\fR] [\\fB\\-\\-wss\\fR \\fIWORD_SPEED\\fR] [\\fB\\-\\-fcc\\fR] \\fB\\-c\\fR \\fITEXT\\fR\n"
            "\\fBmbeep\\fR [\\fB\\-o\\fR \\fIFILE\\fR] [\\fB\\-w\\fR \\fIWPM\\fR] [\\fB\\-x\\fR \\fICHAR_SPEED\\fR] [\\fB\\-\\-wss\\fR \\fIWORD_SPEED\\fR] [\\fB\\-\\-fcc\\fR] \\fB\\-i\\fR \\fIFILE\\fR \\fB\\-c\\fR\n"
+           "\\fBmbeep\\fR [\\fB\\-\\-device\\fR \\fINAME\\fR] [\\fB\\-\\-rate\\fR \\fIRATE\\fR] [\\fB\\-\\-busy\\fR \\fIPOLICY\\fR] \\fB\\-\\-daemon\\fR \\fISOCKET\\fR|\\-\n"
+           "\\fBmbeep\\fR \\fB\\-\\-client\\fR \\fISOCKET\\fR [\\fB\\-\\-priority\\fR \\fIN\\fR] [\\fIOPTIONS\\fR]\n"
+           "\\fBmbeep\\fR [\\fB\\-\\-window\\fR \\fIMSEC\\fR] [\\fB\\-\\-limit\\fR \\fIN\\fR] [\\fB\\-\\-burst\\fR \\fIN\\fR] \\fB\\-\\-events\\fR \\fIFILE\\fR|\\-\n"
+           "\\fBmbeep\\fR [\\fB\\-\\-on\\fR \\fIPATTERN\\fR \\fIOPTIONS\\fR]... \\fB\\-\\-watch\\fR \\fIFILE\\fR\n"
            "\\fBmbeep\\fR \\fB\\-h\\fR | \\fB\\-v\\fR | \\fB\\-\\-midi\\-help\\fR | \\fB\\-\\-morse\\-help\\fR | \\\n"
            "\\fB\\-\\-license\\fR | \\fB\\-\\-man\\-page\\fR\n"
            ".fi\n"
@@ -308,14 +345,78 @@ void man_page_source(void)
            "unless you want tone to play twice.\n"
            "\n"
            ".TP\n"
+           ".BR \\-\\-stream \" \" \\fIN\\fR\n"
+           "Play the following tones on stream \\fIN\\fR (0 to 7). Stream 0 is the main stream; tones for\n"
+           "streams 1 to 7 play in the background, mixed with the main stream and each other, while later\n"
+           "options run, and mbeep waits for them before it exits. For example, an alarm tone over a Morse\n"
+           "message: mbeep \\-\\-stream 1 \\-f 800 \\-t 200 \\-g 300 \\-r 100 \\-p \\-\\-stream 0 \\-c \"message\"\n"
+           "\\-\\-stop\\-stream 1. Background streams are not available in the ALSA and GPIO builds, and\n"
+           "do not apply to \\-\\-play or to .wav files.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-stop\\-stream \" \" \\fIN\\fR\n"
+           "Stop background stream \\fIN\\fR (1 to 7) now, and discard what it has left to play.\n"
+           "\n"
+           ".TP\n"
            ".BR \\-o \" \" \\fIOUTPUT\\fR\n"
-           "Write .wav file containing tones.\n"
+           "Write .wav file containing tones. Use \\- for standard output. When writing to a pipe or other\n"
+           "stream, the header is written first, with exact sizes unless input is read with \\-i, \\-I or\n"
+           "\\-\\-play, in which case sizes are marked as unknown. Files larger than 4 GB are written in RF64\n"
+           "format.\n"
            "\n"
            ".TP\n"
            ".BR \\--wav \" \" \\fIOUTPUT\\fR\n"
            "Write .wav file containing tones.\n"
            "\n"
            ".TP\n"
+           ".BR \\-\\-raw\n"
+           "Write samples to output file without .wav header (for example, to pipe to an encoder).\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-format \" \" \\fIFORMAT\\fR\n"
+           "Format of samples written to .wav file: pcm16 (16-bit integer), pcm24 (24-bit integer), float\n"
+           "(32-bit IEEE floating point), ulaw or alaw (8-bit G.711 mu-law or A-law), or adpcm (4-bit IMA ADPCM)\n"
+           "[default: pcm16]. \\-\\-play reads all of these formats.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-dither\n"
+           "Add triangular (TPDF) dither when rounding samples to 16 bits for .wav file. Silence is not dithered.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-cache \" \" \\fIDIR\\fR\n"
+           "Keep rendered .wav files in directory \\fIDIR\\fR, named by a hash of the options that determine\n"
+           "them (numbers and \\-c text in normal form). When the same options are run again, the file is\n"
+           "copied to the \\-o output by the kernel (copy_file_range or sendfile), or played from a memory\n"
+           "mapping, instead of being synthesized. Applies when the options render one .wav file or one\n"
+           "sound from the options alone: \\-o, if used, must precede the options that play tones, and\n"
+           "options such as \\-i, \\-I, \\-\\-play and \\-\\-stream run as they would without \\-\\-cache.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-cache\\-size \" \" \\fIMB\\fR\n"
+           "Size limit of the \\-\\-cache directory in megabytes (default 64). After a file is added, the\n"
+           "least recently used files are removed until the directory is within the limit.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-tone\\-cache \" \" \\fINAME\\fR\n"
+           "Keep tones (including the dits and dahs of Morse code) in the POSIX shared memory segment\n"
+           "\\fINAME\\fR (such as /mbeep\\-tones), created if it doesn't exist, and reuse tones that this or\n"
+           "other processes have rendered there instead of synthesizing them. The segment holds 32 MB of\n"
+           "tones; when it is full, new tones are synthesized as usual. It lasts until it is removed (on\n"
+           "Linux, from /dev/shm) or the system restarts.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-compile \" \" \\fIFILE\\fR\n"
+           "Write the tones and gaps that the options after this play (for example, the Morse code of \\-c,\n"
+           "or the notes of \\-m) to tone program \\fIFILE\\fR, instead of playing them or writing them to\n"
+           "the \\-o output. Tone programs can only be run on machines with the same byte order.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-run \" \" \\fIFILE\\fR\n"
+           "Play tone program \\fIFILE\\fR, or write it to the \\-o output, without translating text or\n"
+           "notes again. The file is memory-mapped and read as it plays. Speed, tempo and gap options were\n"
+           "applied when it was written; options that apply to all tones, such as \\-\\-rate, apply as usual.\n"
+           "\n"
+           ".TP\n"
            ".BR \\-b \" \" \\fITEMPO\\fR\n"
            "Quarter notes per minute. Default is 120.\n"
            "\n"
@@ -345,7 +446,122 @@ void man_page_source(void)
            "\n"
            ".TP\n"
            ".BR \\-\\-play\n"
-           "Play .wav file written by mbeep (for testing).\n"
+           "Play .wav file: 8, 16, 24 or 32-bit integer or 32 or 64-bit float samples, with any number of\n"
+           "channels (mixed to mono), or mono mu-law, A-law or IMA ADPCM samples.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-fixed\\-point\n"
+           "Generate tones using integer arithmetic only (phase accumulator and sine table), which is much\n"
+           "faster on processors without fast floating point, such as the Raspberry Pi Zero. Samples differ\n"
+           "from floating-point synthesis by at most 1. This is the default if built with make FIXED_POINT=1.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-floating\\-point\n"
+           "Generate tones using floating-point arithmetic (default).\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-rate \" \" \\fIRATE\\fR\n"
+           "Sample rate for tones played or written to .wav file: 8000, 16000, 22050, 44100, 48000 or 96000 Hz,\n"
+           "or native to use the audio device's own mixing rate, so that tones are not resampled before\n"
+           "they are played [default: 44100]. Must precede any option that plays sound.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-synth\\-rate \" \" \\fIRATE\\fR\n"
+           "Synthesize tones at this rate (8000, 16000, 22050, 44100, 48000 or 96000 Hz), and resample them\n"
+           "to the sample rate. A low rate reduces the cost of synthesis, but tones must be below half of it.\n"
+           "Must precede any option that plays sound.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-resample \" \" \\fIQUALITY\\fR\n"
+           "Quality of the polyphase resampler used for tones synthesized with \\-\\-synth\\-rate, and for .wav\n"
+           "files played with \\-\\-play whose rate differs from the sample rate: fast (8-tap filter), medium\n"
+           "(24 taps) or best (64 taps). device leaves resampling of .wav files to the audio device\n"
+           "[default: medium].\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-device \" \" \\fINAME\\fR\n"
+           "Audio output device, instead of the system default device. Must precede any option\n"
+           "that plays sound. For the ALSA build (make ALSA=1), this is an ALSA PCM name such as\n"
+           "hw:0, plughw:0, null or a file plugin defined in ~/.asoundrc.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-loopback\n"
+           "Play through an OpenAL Soft loopback device (ALC_SOFT_loopback extension) instead of a sound\n"
+           "card, rendering device output in accelerated time, and print statistics when done: requested,\n"
+           "submitted and played duration, latency from start of playing to first output sample, buffer queue\n"
+           "depth, and CPU time per second of audio (for testing). Must precede any option that plays sound.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-daemon \" \" \\fISOCKET\\fR\n"
+           "Open the audio device, then wait for requests from clients on the Unix domain socket\n"
+           "\\fISOCKET\\fR and run them one at a time, until stopped by SIGINT or SIGTERM. Requests start\n"
+           "playing without the cost of starting mbeep and opening the device. Options that set up the device\n"
+           "(\\-\\-device, \\-\\-rate, \\-\\-synth\\-rate, \\-\\-loopback) must precede \\-\\-daemon; other settings\n"
+           "changed by a request don't carry over to the next. If \\fISOCKET\\fR is \\-, each line of standard\n"
+           "input is a request, with options separated by spaces (quote an option containing spaces with \"\"\n"
+           "or ''), run in the daemon's working directory; the daemon exits at the end of input. As standard\n"
+           "input holds the requests, these can't use \\-I.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-busy \" \" \\fIPOLICY\\fR\n"
+           "What the daemon does with a request that arrives while another is playing, if it doesn't preempt\n"
+           "it: \\fBqueue\\fR (default) runs it when the device is free, highest priority first, and\n"
+           "\\fBdrop\\fR drops it, and the client reports SE_BUSY. Must precede \\-\\-daemon.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-client \" \" \\fISOCKET\\fR\n"
+           "Send the rest of the options to the daemon listening on \\fISOCKET\\fR, and wait until they have\n"
+           "been played. Must be the first option. Options are run with the client's working directory and\n"
+           "standard input, output and error, so \\-o, \\-i and \\-I work as they do on the command line.\n"
+           "The exit status is nonzero if the request failed, as it is for options run directly.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-priority \" \" \\fIN\\fR\n"
+           "Priority of a daemon request (default 0); must be the first option after \\-\\-client \\fISOCKET\\fR,\n"
+           "or on a line of standard input. A request with a higher priority than the one playing preempts it:\n"
+           "within a few milliseconds, the sound playing is faded out, what was queued after it is discarded,\n"
+           "and the client of the preempted request reports SE_PREEMPTED.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-events \" \" \\fIFILE\\fR\n"
+           "Open the audio device, then read lines describing events from \\fIFILE\\fR (\\- for standard\n"
+           "input) as they arrive, until the end of the file or SIGINT or SIGTERM, and play them so that a\n"
+           "storm of events costs little and stays intelligible. A line is \\fICLASS\\fR [\\fIOPTIONS\\fR]:\n"
+           "the class is a word naming the kind of event, and the options say how to play it, as on the\n"
+           "command line (\\-p if none). Events of a class that arrive within the window of the first are\n"
+           "played once, followed by their count in Morse code if there is more than one. Each class is\n"
+           "played at most at the rate given by \\-\\-limit; events that arrive while their class waits are\n"
+           "added to the count. Options that set up the device must precede \\-\\-events.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-window \" \" \\fIMSEC\\fR\n"
+           "Time after the first event of a class in which further events of the class are counted rather\n"
+           "than played (default 1000). Must precede \\-\\-events.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-limit \" \" \\fIN\\fR\n"
+           "Number of times per minute each class of events may be played (default 12). Must precede\n"
+           "\\-\\-events.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-burst \" \" \\fIN\\fR\n"
+           "Number of plays a class of events can save up while it is quiet, to be used without waiting\n"
+           "(default 3). Must precede \\-\\-events.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-watch \" \" \\fIFILE\\fR\n"
+           "Open the audio device, then follow \\fIFILE\\fR like \\fBtail \\-F\\fR, and play each line\n"
+           "written to it as soon as it is written, until SIGINT or SIGTERM. Lines already in the file are\n"
+           "skipped. When the file is rotated (renamed and created again) or truncated, the new contents are\n"
+           "read from the beginning; the file need not exist yet. Uses inotify, so it is only available on\n"
+           "Linux. Options that set up the device must precede \\-\\-watch.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-on \" \" \\fIPATTERN\\fR \" \" \\fIOPTIONS\\fR\n"
+           "Play \\fIOPTIONS\\fR (one argument, with options separated by spaces, as on the command line)\n"
+           "for lines of the watched file that match the extended regular expression \\fIPATTERN\\fR. The\n"
+           "first pattern that matches is used, and lines that match none are not played. Without \\-\\-on,\n"
+           "every line is played as a single tone (\\-p). Must precede \\-\\-watch.\n"
            "\n"
            ".TP\n"
            ".BR \\-I\n"
@@ -437,6 +653,44 @@ void man_page_source(void)
            ".fi\n"
            ".PP\n"
            "\n"
+           "Send Morse code to an encoder through a pipe:\n"
+           ".PP\n"
+           ".nf\n"
+           ".RS\n"
+           "\\fBmbeep -o - -c \"cq cq de w1aw\" | flac -o cq.flac -\\fR\n"
+           ".RE\n"
+           ".fi\n"
+           ".PP\n"
+           "\n"
+           "Keep the device open, and beep from other commands:\n"
+           ".PP\n"
+           ".nf\n"
+           ".RS\n"
+           "\\fBmbeep --daemon /tmp/mbeep.sock &\\fR\n"
+           "\\fBmbeep --client /tmp/mbeep.sock -f 880 -t 100 -r 3\\fR\n"
+           "\\fBmbeep --client /tmp/mbeep.sock --priority 9 -c sos\\fR\n"
+           ".RE\n"
+           ".fi\n"
+           ".PP\n"
+           "\n"
+           "Beep for monitoring events, at most twice a minute for each kind:\n"
+           ".PP\n"
+           ".nf\n"
+           ".RS\n"
+           "\\fBmonitor | mbeep --limit 2 --events -\\fR\n"
+           ".RE\n"
+           ".fi\n"
+           ".PP\n"
+           "\n"
+           "Beep for errors written to a log, and send Morse code for a full disk:\n"
+           ".PP\n"
+           ".nf\n"
+           ".RS\n"
+           "\\fBmbeep --on 'No space left' '-c disk' --on ERROR '-f 880 -t 100' --watch /var/log/syslog\\fR\n"
+           ".RE\n"
+           ".fi\n"
+           ".PP\n"
+           "\n"
            ".SH SEE ALSO\n"
            ".BR beep (1)\n"
            "\n"
@@ -447,6 +701,12 @@ void man_page_source(void)
            "be used as input to a pizeo speaker element.\n"
            "\n"
 
+#elif defined(ALSA)
+           "This version of mbeep was compiled via the build command \"make ALSA=1\" and writes tones "
+           "directly into the ALSA device's memory-mapped ring buffer, at the device's native sample "
+           "rate, instead of using OpenAL.\n"
+           "\n"
+
 #else
            "The common beep tool on Unix systems does not work on the Mac, because the Mac does not have a simple piezo\n"
            "speaker on the motherboard. The mbeep tool uses the OpenAL framework, which is built into the macOS system;\n"
@@ -0,0 +1,278 @@
+//
+// tonecache.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// for shm_open(), ftruncate(), nanosleep() and kill()
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tonecache.h"
+
+// The segment is a header, an open-addressing hash table of slots, then tone data, allocated by
+// bumping an offset. A slot goes from empty to claimed (by compare-and-swap) to ready, when its
+// tone has been rendered; a reader uses a slot only once it is ready, so it never sees part of a
+// tone. A reader doesn't wait for a claimed slot, so two processes may render the same tone at
+// once; the second copy is never found, which only wastes space. A slot records the pid of the
+// process that claimed it, so that a slot whose process died before publishing its tone is claimed
+// again. The process that creates the segment records its pid, then sets the magic number last;
+// one that finds the segment not set up waits for as long as that process exists, and if it has
+// died, creates the segment again. A segment whose creator hasn't got as far as recording its pid
+// within SETUP_WAIT_MSEC is left alone, and tones are synthesized as usual.
+#define TONE_CACHE_MAGIC 0x6d62746eU
+#define TONE_CACHE_VERSION 2
+#define TONE_CACHE_SLOTS 4096
+#define TONE_CACHE_SIZE (32 << 20)
+#define MAX_TONE_PROBES 64
+#define SETUP_WAIT_MSEC 100
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+enum {
+    SLOT_EMPTY = 0,
+    SLOT_CLAIMED,
+    SLOT_READY,
+    SLOT_FAILED         // no space for tone
+};
+
+// state of slot, with pid of process that claimed it, changed together by compare-and-swap
+#define SLOT_CLAIM(state, pid) ((uint64_t)(uint32_t)(pid) << 32 | (uint32_t)(state))
+#define CLAIM_STATE(claim) ((uint32_t)(claim))
+#define CLAIM_PID(claim) ((pid_t)((claim) >> 32))
+
+struct ToneSlot {
+    uint64_t claim;
+    ToneKey key;
+    uint64_t offset;    // of samples, from start of segment
+};
+typedef struct ToneSlot ToneSlot;
+
+struct ToneCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint64_t data_used; // bytes of tone data allocated
+    uint64_t creator;   // pid of process that created segment, once it has been sized
+    ToneSlot slots[TONE_CACHE_SLOTS];
+};
+typedef struct ToneCacheHeader ToneCacheHeader;
+
+ToneCacheHeader *tone_cache = NULL;
+
+// false only if there is certainly no process pid (one owned by another user still exists)
+bool process_exists(pid_t pid);
+bool process_exists(pid_t pid)
+{
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// map segment with name, creating it if it doesn't exist; sets stale if it exists, but the process
+// that created it died before setting it up
+SoundError map_tone_cache(const char *name, bool *stale);
+SoundError map_tone_cache(const char *name, bool *stale)
+{
+    SoundError error = SE_NO_ERROR;
+    bool created = false;
+    struct stat status;
+    ToneCacheHeader *header = NULL;
+    int waited_msec = 0;
+    bool unknown_creator = false;
+    struct timespec ts = { 0, 1000000 };
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd >= 0) {
+        created = true;
+        if (ftruncate(fd, TONE_CACHE_SIZE) != 0) error = SE_OUT_OF_MEMORY;
+
+    } else if (errno == EEXIST) {
+        fd = shm_open(name, O_RDWR, 0);
+    }
+
+    if (fd < 0) error = errno == EINVAL || errno == ENAMETOOLONG ? SE_INVALID_NAME : SE_OUT_OF_MEMORY;
+
+    // another process may have created the segment, but not yet set its size
+    while (error == SE_NO_ERROR && header == NULL && waited_msec <= SETUP_WAIT_MSEC) {
+        if (fstat(fd, &status) != 0) {
+            error = SE_OUT_OF_MEMORY;
+
+        } else if (status.st_size >= (off_t)sizeof(ToneCacheHeader)) {
+            void *map = mmap(NULL, (size_t)status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (map == MAP_FAILED) {
+                error = SE_OUT_OF_MEMORY;
+
+            } else {
+                header = (ToneCacheHeader *)map;
+            }
+
+        } else {
+            waited_msec++;
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    if (header != NULL && created) {
+        __atomic_store_n(&header->creator, (uint64_t)getpid(), __ATOMIC_RELEASE);
+        header->version = TONE_CACHE_VERSION;
+        header->size = (uint64_t)status.st_size;
+        header->data_used = sizeof(ToneCacheHeader);
+        __atomic_store_n(&header->magic, TONE_CACHE_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    // ... or not yet set its magic number, which it is waited for as long as it exists
+    while (header != NULL && __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != TONE_CACHE_MAGIC &&
+           !*stale && !unknown_creator) {
+        pid_t creator = (pid_t)__atomic_load_n(&header->creator, __ATOMIC_ACQUIRE);
+
+        if (creator != 0 && !process_exists(creator)) {
+            *stale = true;
+
+        } else if (creator == 0 && waited_msec++ > SETUP_WAIT_MSEC) {
+            // can't tell whether its creator is still at work
+            unknown_creator = true;
+
+        } else {
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    if (header != NULL) {
+        // a segment of another version, or one that isn't set up yet, is left alone
+        if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == TONE_CACHE_MAGIC &&
+            header->version == TONE_CACHE_VERSION && header->size == (uint64_t)status.st_size) {
+            tone_cache = header;
+
+        } else {
+            munmap(header, (size_t)status.st_size);
+        }
+    }
+
+    // so that later processes don't find a segment that will never be set up
+    if (created && error != SE_NO_ERROR) shm_unlink(name);
+
+    if (fd >= 0) close(fd);
+
+    return error;
+}
+
+// attach to shared tone cache with name (such as /mbeep-tones), creating it if it doesn't exist; a
+// segment left half set up by a process that has since died is removed and created again
+SoundError attach_tone_cache(const char *name)
+{
+    SoundError error = SE_NO_ERROR;
+    bool stale = false;
+
+    if (tone_cache != NULL) return error;
+
+    error = map_tone_cache(name, &stale);
+
+    if (error == SE_NO_ERROR && stale) {
+        shm_unlink(name);
+        stale = false;
+        error = map_tone_cache(name, &stale);
+    }
+
+    return error;
+}
+
+uint64_t fnv1a_hash(const void *data, size_t size)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (size_t k = 0; k < size; k++) {
+        hash ^= ((const unsigned char *)data)[k];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+// samples of tone, rendered by render if it isn't in the cache yet; NULL if there is no cache, or
+// no room for tone
+const int16_t *cached_tone(const ToneKey *key, ToneRenderer render)
+{
+    const int16_t *samples = NULL;
+
+    if (tone_cache == NULL) return samples;
+
+    uint64_t hash = fnv1a_hash(key, sizeof(ToneKey));
+
+    uint64_t bytes = (key->total_count * sizeof(int16_t) + 7) & ~(uint64_t)7;
+    pid_t pid = getpid();
+    bool done = false;
+
+    for (int probe = 0; probe < MAX_TONE_PROBES && !done; probe++) {
+        ToneSlot *slot = &tone_cache->slots[(hash + (uint64_t)probe) % TONE_CACHE_SLOTS];
+        uint64_t claim = __atomic_load_n(&slot->claim, __ATOMIC_ACQUIRE);
+        uint32_t state = CLAIM_STATE(claim);
+        pid_t owner = CLAIM_PID(claim);
+
+        if (state == SLOT_READY && memcmp(&slot->key, key, sizeof(ToneKey)) == 0) {
+            samples = (const int16_t *)((const char *)tone_cache + slot->offset);
+            done = true;
+
+        } else if (state == SLOT_EMPTY ||
+                   (state == SLOT_CLAIMED && owner != pid && !process_exists(owner))) {
+            // an empty slot, or one whose process died before publishing its tone, whose data (if
+            // any was allocated) is abandoned
+            if (__atomic_compare_exchange_n(&slot->claim, &claim, SLOT_CLAIM(SLOT_CLAIMED, pid), false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                uint64_t offset = __atomic_fetch_add(&tone_cache->data_used, bytes, __ATOMIC_RELAXED);
+
+                slot->key = *key;
+
+                if (offset + bytes <= tone_cache->size) {
+                    int16_t *data = (int16_t *)((char *)tone_cache + offset);
+
+                    render(data, key);
+                    slot->offset = offset;
+                    samples = data;
+                    __atomic_store_n(&slot->claim, SLOT_CLAIM(SLOT_READY, pid), __ATOMIC_RELEASE);
+
+                } else {
+                    __atomic_store_n(&slot->claim, SLOT_CLAIM(SLOT_FAILED, pid), __ATOMIC_RELEASE);
+                }
+
+                done = true;
+
+            } else {
+                // another process claimed slot first; look at it again
+                probe--;
+            }
+        }
+    }
+
+    return samples;
+}
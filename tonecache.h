@@ -0,0 +1,61 @@
+//
+// tonecache.h
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef tonecache_h
+#define tonecache_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sound.h"
+
+// Shared tone cache: whole tones, as 16-bit samples, in a POSIX shared memory segment that every
+// mbeep process given the same name attaches to, so short-lived processes reuse tones (and the
+// dits and dahs of Morse code) rendered by others instead of synthesizing them. Lookups take no
+// locks; a tone is rendered into space claimed with atomic operations, then published. Tones are
+// never removed: once the segment is full, further tones are synthesized as usual. The segment
+// lasts until it is removed (on Linux, from /dev/shm) or the system restarts.
+
+// everything that determines the samples of a tone; compared as bytes, so it has no padding
+struct ToneKey {
+    double freq;
+    uint64_t total_count;
+    uint64_t ramp_count;
+    uint32_t rate;
+    uint32_t fixed_point;
+};
+typedef struct ToneKey ToneKey;
+
+// renders all samples of tone into data
+typedef void (*ToneRenderer)(int16_t *data, const ToneKey *key);
+
+SoundError attach_tone_cache(const char *name);
+const int16_t *cached_tone(const ToneKey *key, ToneRenderer render);
+
+// 64-bit FNV-1a hash of size bytes of data; also names files of the render cache (see cache.h)
+uint64_t fnv1a_hash(const void *data, size_t size);
+
+#endif /* tonecache_h */
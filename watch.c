@@ -0,0 +1,257 @@
+//
+// watch.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// for strdup()
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "watch.h"
+
+#define MAX_WATCH_PATTERNS 32
+#define MAX_WATCH_LINE 4096
+
+struct WatchPattern {
+    regex_t regex;
+    char *options;          // each NUL-terminated, from split_options()
+    size_t options_size;
+};
+typedef struct WatchPattern WatchPattern;
+
+WatchPattern watch_patterns[MAX_WATCH_PATTERNS];
+int watch_pattern_count = 0;
+
+// play options when a line matches pattern; patterns are tried in the order they are added
+SoundError add_watch_pattern(const char *pattern, const char *options)
+{
+    SoundError error = SE_NO_ERROR;
+    WatchPattern *watch_pattern = &watch_patterns[watch_pattern_count];
+
+    if (watch_pattern_count == MAX_WATCH_PATTERNS) {
+        error = SE_INVALID_VALUE;
+
+    } else if (regcomp(&watch_pattern->regex, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+        error = SE_INVALID_VALUE;
+
+    } else {
+        watch_pattern->options = (char *)malloc(strlen(options) + 1);
+
+        if (watch_pattern->options == NULL) {
+            regfree(&watch_pattern->regex);
+            error = SE_OUT_OF_MEMORY;
+
+        } else {
+            watch_pattern->options_size = split_options(options, strlen(options), watch_pattern->options);
+            watch_pattern_count++;
+        }
+    }
+
+    return error;
+}
+
+void clear_watch_patterns(void)
+{
+    for (int k = 0; k < watch_pattern_count; k++) {
+        regfree(&watch_patterns[k].regex);
+        free(watch_patterns[k].options);
+    }
+
+    watch_pattern_count = 0;
+}
+
+#ifdef __linux__
+// The directory of the file is watched for a file of its name being created or moved in, which is
+// when the log has been rotated; the file itself is watched for being written. Nothing is read
+// until inotify reports a change, so there is no polling.
+#define NOTIFY_BUFFER_SIZE (16 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+int notify_fd = -1;
+int file_watch = -1;
+int watched_fd = -1;
+char watch_text[MAX_WATCH_LINE + 1];
+LineBuffer watch_lines = { watch_text, MAX_WATCH_LINE, 0 };
+RequestHandler watch_handler = NULL;
+
+// play options of first pattern that matches line; a line too long for the buffer is played in
+// pieces
+void play_line(char *line, size_t length, bool complete);
+void play_line(char *line, size_t length, bool complete)
+{
+    (void)length;
+    (void)complete;
+
+    WatchPattern *match = NULL;
+    SoundError error = SE_NO_ERROR;
+
+    for (int k = 0; k < watch_pattern_count && match == NULL; k++) {
+        if (regexec(&watch_patterns[k].regex, line, 0, NULL, 0) == 0) match = &watch_patterns[k];
+    }
+
+    if (match != NULL) {
+        error = run_split_options(match->options, match->options_size, watch_handler);
+
+    } else if (watch_pattern_count == 0) {
+        error = run_split_options(NULL, 0, watch_handler);
+    }
+
+    report_error(error);
+}
+
+// open file at path, and watch it for being written; if at_end, only what is written from now on
+// is read. The file may not exist yet.
+void open_watched(const char *path, bool at_end);
+void open_watched(const char *path, bool at_end)
+{
+    // watch before opening, so that nothing written in between is missed
+    file_watch = inotify_add_watch(notify_fd, path, IN_MODIFY);
+    watched_fd = open(path, O_RDONLY);
+
+    if (watched_fd >= 0 && at_end) lseek(watched_fd, 0, SEEK_END);
+    watch_lines.length = 0;
+}
+
+void close_watched(void);
+void close_watched(void)
+{
+    if (file_watch >= 0) inotify_rm_watch(notify_fd, file_watch);
+    if (watched_fd >= 0) close(watched_fd);
+
+    file_watch = -1;
+    watched_fd = -1;
+}
+
+// read what has been written to file, and play each complete line
+void read_watched(void);
+void read_watched(void)
+{
+    struct stat status;
+    ssize_t received = 1;
+
+    // file truncated in place (copytruncate): start again from the beginning
+    if (watched_fd >= 0 && fstat(watched_fd, &status) == 0 && status.st_size < lseek(watched_fd, 0, SEEK_CUR)) {
+        lseek(watched_fd, 0, SEEK_SET);
+        watch_lines.length = 0;
+    }
+
+    while (watched_fd >= 0 && received > 0 && !stop_requested()) {
+        received = read_lines(&watch_lines, watched_fd, play_line);
+    }
+}
+#endif
+
+// Follow file at path, playing lines as they are written, until SIGINT or SIGTERM. Lines already
+// in the file are skipped; after the file is rotated, the new file is read from the beginning.
+SoundError watch_file(const char *path, RequestHandler handler)
+{
+#ifdef __linux__
+    SoundError error = SE_NO_ERROR;
+    char *directory_copy = strdup(path);
+    char *name_copy = strdup(path);
+    const char *name = NULL;
+    int directory_watch = -1;
+
+    if (directory_copy == NULL || name_copy == NULL) error = SE_OUT_OF_MEMORY;
+
+    if (error == SE_NO_ERROR) {
+        name = basename(name_copy);
+        notify_fd = inotify_init1(IN_CLOEXEC);
+        if (notify_fd >= 0) directory_watch = inotify_add_watch(notify_fd, dirname(directory_copy), IN_CREATE | IN_MOVED_TO);
+        if (directory_watch < 0) error = SE_INPUT_FILE_OPEN_ERROR;
+    }
+
+    if (error == SE_NO_ERROR) {
+        watch_handler = handler;
+        catch_stop_signals();
+        set_preempt_check(stop_requested);
+        open_watched(path, true);
+    }
+
+    while (error == SE_NO_ERROR && !stop_requested()) {
+        union {
+            struct inotify_event aligned;
+            char bytes[NOTIFY_BUFFER_SIZE];
+        } events;
+        ssize_t received = read(notify_fd, events.bytes, sizeof(events.bytes));
+        bool written = false;
+        bool replaced = false;
+
+        if (received < 0 && errno != EINTR) error = SE_FILE_READ_ERROR;
+
+        for (ssize_t k = 0; k < received; ) {
+            const struct inotify_event *event = (const struct inotify_event *)(events.bytes + k);
+
+            if (event->wd == directory_watch && event->len > 0 && strcmp(event->name, name) == 0) {
+                replaced = true;
+
+            } else if (event->wd == file_watch && (event->mask & IN_MODIFY) != 0) {
+                written = true;
+            }
+
+            k += sizeof(struct inotify_event) + event->len;
+        }
+
+        // finish the old file before moving on to the new one
+        if (written || replaced) read_watched();
+
+        if (replaced) {
+            close_watched();
+            open_watched(path, false);
+            read_watched();
+        }
+    }
+
+    set_preempt_check(NULL);
+    close_watched();
+    if (notify_fd >= 0) close(notify_fd);
+    notify_fd = -1;
+
+    free(directory_copy);
+    free(name_copy);
+
+    return error;
+
+#else
+    // inotify is only available on Linux
+    (void)path;
+    (void)handler;
+
+    return SE_INVALID_OPTION;
+#endif
+}
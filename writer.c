@@ -0,0 +1,227 @@
+//
+// writer.c
+// mbeep
+//
+// Copyright (C) 2026 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+// for fseeko() and ftruncate()
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "writer.h"
+
+#define WRITER_BLOCKS 2
+#define WRITER_BLOCK_SIZE (1 << 18)
+
+// blocks are filled in turn, then written in turn; a full block belongs to the writer thread
+// until it has been written. A block may be followed by a hole, which is seeked over.
+typedef struct WriterBlock {
+    uint8_t *data;
+    size_t size;
+    uint64_t skip;
+    bool full;
+} WriterBlock;
+
+WriterBlock writer_blocks[WRITER_BLOCKS];
+size_t writer_fill_index = 0;
+FILE *writer_file = NULL;
+bool writer_started = false;
+
+// shared with writer thread
+pthread_t writer_thread;
+pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+bool writer_stopping = false;
+SoundError writer_error = SE_NO_ERROR;
+
+// writer thread: write full blocks in order until stopped; after an error, blocks are discarded
+void *write_blocks(void *arg);
+void *write_blocks(void *arg)
+{
+    size_t write_index = 0;
+    bool hole_at_end = false;
+    bool done = false;
+
+    pthread_mutex_lock(&writer_mutex);
+
+    while (!done) {
+        WriterBlock *block = &writer_blocks[write_index];
+
+        if (block->full) {
+            bool ok = writer_error == SE_NO_ERROR;
+
+            pthread_mutex_unlock(&writer_mutex);
+            if (ok) ok = block->size == fwrite(block->data, 1, block->size, writer_file);
+            if (ok && block->skip > 0) ok = fseeko(writer_file, (off_t)block->skip, SEEK_CUR) == 0;
+            pthread_mutex_lock(&writer_mutex);
+
+            if (block->size > 0) hole_at_end = false;
+            if (block->skip > 0) hole_at_end = true;
+
+            if (!ok) writer_error = SE_FILE_WRITE_ERROR;
+            block->size = 0;
+            block->skip = 0;
+            block->full = false;
+            write_index = (write_index + 1) % WRITER_BLOCKS;
+            pthread_cond_broadcast(&writer_cond);
+
+        } else if (writer_stopping) {
+            done = true;
+
+        } else {
+            pthread_cond_wait(&writer_cond, &writer_mutex);
+        }
+    }
+
+    // report errors from data still buffered by stdio
+    if (writer_error == SE_NO_ERROR && fflush(writer_file) != 0) writer_error = SE_FILE_WRITE_ERROR;
+
+    // seeking past the end doesn't make the file longer; a hole at the end is made by extending it
+    if (writer_error == SE_NO_ERROR && hole_at_end &&
+        ftruncate(fileno(writer_file), ftello(writer_file)) != 0) {
+        writer_error = SE_FILE_WRITE_ERROR;
+    }
+
+    pthread_mutex_unlock(&writer_mutex);
+
+    return NULL;
+}
+
+// start writer thread; file must not be used by caller until stop_writer()
+SoundError start_writer(FILE *file)
+{
+    SoundError error = SE_NO_ERROR;
+
+    for (int k = 0; k < WRITER_BLOCKS; k++) {
+        writer_blocks[k].data = malloc(WRITER_BLOCK_SIZE);
+        writer_blocks[k].size = 0;
+        writer_blocks[k].skip = 0;
+        writer_blocks[k].full = false;
+        if (writer_blocks[k].data == NULL) error = SE_OUT_OF_MEMORY;
+    }
+
+    writer_file = file;
+    writer_fill_index = 0;
+    writer_stopping = false;
+    writer_error = SE_NO_ERROR;
+
+    if (error == SE_NO_ERROR && pthread_create(&writer_thread, NULL, write_blocks, NULL) != 0) {
+        error = SE_OUT_OF_MEMORY;
+    }
+
+    writer_started = error == SE_NO_ERROR;
+
+    if (!writer_started) {
+        for (int k = 0; k < WRITER_BLOCKS; k++) {
+            free(writer_blocks[k].data);
+            writer_blocks[k].data = NULL;
+        }
+    }
+
+    return error;
+}
+
+bool writer_running(void)
+{
+    return writer_started;
+}
+
+// hand block being filled to writer thread, and wait until next block is free
+void hand_off_block(void);
+void hand_off_block(void)
+{
+    pthread_mutex_lock(&writer_mutex);
+
+    writer_blocks[writer_fill_index].full = true;
+    pthread_cond_broadcast(&writer_cond);
+
+    writer_fill_index = (writer_fill_index + 1) % WRITER_BLOCKS;
+    while (writer_blocks[writer_fill_index].full) pthread_cond_wait(&writer_cond, &writer_mutex);
+
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+// space for size bytes (no more than WRITER_BLOCK_SIZE) at end of block being filled; samples
+// written there are committed by writer_advance()
+uint8_t *writer_space(size_t size)
+{
+    if (writer_blocks[writer_fill_index].size + size > WRITER_BLOCK_SIZE) hand_off_block();
+
+    return writer_blocks[writer_fill_index].data + writer_blocks[writer_fill_index].size;
+}
+
+void writer_advance(size_t size)
+{
+    writer_blocks[writer_fill_index].size += size;
+}
+
+// leave a hole of size bytes after the data so far, by seeking instead of writing zeroes; file must
+// be seekable. File systems that support sparse files don't allocate space for the hole.
+void writer_skip(uint64_t size)
+{
+    writer_blocks[writer_fill_index].skip = size;
+    hand_off_block();
+}
+
+// first write error so far
+SoundError writer_status(void)
+{
+    pthread_mutex_lock(&writer_mutex);
+    SoundError error = writer_error;
+    pthread_mutex_unlock(&writer_mutex);
+
+    return error;
+}
+
+// write remaining data and stop writer thread; returns first write error
+SoundError stop_writer(void)
+{
+    SoundError error = SE_NO_ERROR;
+
+    if (writer_started) {
+        if (writer_blocks[writer_fill_index].size > 0) hand_off_block();
+
+        pthread_mutex_lock(&writer_mutex);
+        writer_stopping = true;
+        pthread_cond_broadcast(&writer_cond);
+        pthread_mutex_unlock(&writer_mutex);
+
+        pthread_join(writer_thread, NULL);
+        error = writer_error;
+
+        for (int k = 0; k < WRITER_BLOCKS; k++) {
+            free(writer_blocks[k].data);
+            writer_blocks[k].data = NULL;
+        }
+
+        writer_file = NULL;
+        writer_started = false;
+    }
+
+    return error;
+}